@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "expect.h"
+#include "governor.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+void
+gov_init(gov_t *g, double threshold)
+{
+    memset(g, 0, sizeof(*g));
+    g->threshold = threshold;
+}
+
+void
+gov_free(gov_t *g)
+{
+    free(g->points);
+    g->points = NULL;
+    g->n_points = g->max_points = 0;
+}
+
+/* Point of a size, added with no delay the first time */
+static gov_point_t *
+gov_point(gov_t *g, uint32_t size)
+{
+    int lo = 0, hi = g->n_points;
+    gov_point_t *p;
+
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+
+        if (g->points[mid].size < size)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < g->n_points && g->points[lo].size == size)
+        return &g->points[lo];
+
+    if (g->n_points == g->max_points) {
+        g->max_points = g->max_points ? 2 * g->max_points : 16;
+        EXPECT(g->points = realloc(g->points,
+                                   g->max_points * sizeof(gov_point_t)));
+    }
+    p = &g->points[lo];
+    memmove(p + 1, p, (g->n_points - lo) * sizeof(gov_point_t));
+    g->n_points++;
+
+    memset(p, 0, sizeof(*p));
+    p->size = size;
+    p->hi = GOV_NO_HI;
+    return p;
+}
+
+uint32_t
+gov_delay(gov_t *g, uint32_t size)
+{
+    return gov_point(g, size)->delay;
+}
+
+void
+gov_add(gov_t *g, uint32_t size, uint64_t misses, uint64_t accesses)
+{
+    gov_point_t *p = gov_point(g, size);
+
+    if (accesses < GOV_MIN_ACCESSES)
+        return;
+
+    p->n++;
+    p->ratio = (double)misses / accesses;
+    if (p->ratio <= g->threshold) {
+        p->lo = p->delay;
+    } else {
+        p->hi = p->delay;
+        /* The delay it had settled at loses lines now */
+        if (p->lo >= p->hi)
+            p->lo = p->hi / 2;
+    }
+
+    if (p->hi == GOV_NO_HI)
+        p->delay = MIN(p->lo ? 2 * p->lo : GOV_FIRST_DELAY_NS,
+                       GOV_MAX_DELAY_NS);
+    else if (p->hi - p->lo > MAX(GOV_RESOLUTION_NS, p->lo / 16))
+        p->delay = p->lo + (p->hi - p->lo) / 2;
+    else
+        p->delay = p->lo;
+}
+
+void
+gov_print(FILE *out, const gov_t *g)
+{
+    for (int i = 0; i < g->n_points; i++) {
+        const gov_point_t *p = &g->points[i];
+
+        fprintf(out, "%10u: n=%-6" PRIu64 " delay=%u ns [%u, ",
+                p->size, p->n, p->delay, p->lo);
+        if (p->hi == GOV_NO_HI)
+            fprintf(out, "-]");
+        else
+            fprintf(out, "%u]", p->hi);
+        fprintf(out, " fetch ratio=%g\n", p->ratio);
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Pirate intensity governor, --governor.
+ *
+ * The pirates hold their share of the cache as long as they touch
+ * every line again before the target evicts it, which they do at far
+ * less than their full speed at most sizes. Running flat out only
+ * adds LLC and memory bandwidth contention. The governor slows every
+ * pirate down with a delay after each line, and finds the longest
+ * delay at each pirate size that keeps the pirates' fetch ratio (LLC
+ * misses per LLC access) at or below a threshold.
+ *
+ * Every size has its own binary search: lo is the longest delay seen
+ * to keep the fetch ratio low and hi the shortest delay seen to lose
+ * lines. The delay doubles until the first loss, and is then halved
+ * between lo and hi down to a resolution, where the size settles at
+ * lo. A delay that starts losing lines later moves the search below
+ * it again. Each sample at a size is one step, so a sweep converges
+ * after a few cycles.
+ */
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* First delay tried, longest delay and resolution of the search, in
+ * ns per line */
+#define GOV_FIRST_DELAY_NS 4
+#define GOV_MAX_DELAY_NS 8192
+#define GOV_RESOLUTION_NS 2
+/* Samples with fewer pirate LLC accesses don't change the delay */
+#define GOV_MIN_ACCESSES 1000
+#define GOV_NO_HI UINT32_MAX
+
+typedef struct {
+    uint32_t size;
+    /* Delay of the next sample, and the search interval, hi is
+     * GOV_NO_HI until a delay has lost lines */
+    uint32_t delay;
+    uint32_t lo;
+    uint32_t hi;
+    uint64_t n;
+    /* Fetch ratio of the last sample */
+    double ratio;
+} gov_point_t;
+
+typedef struct {
+    double threshold;
+    /* Sorted by size */
+    gov_point_t *points;
+    int n_points;
+    int max_points;
+} gov_t;
+
+/**
+ * Set up a governor.
+ *
+ * @param threshold Highest fetch ratio of the pirates
+ */
+void gov_init(gov_t *g, double threshold);
+
+void gov_free(gov_t *g);
+
+/**
+ * Delay in ns per line to run the pirates at at a size.
+ */
+uint32_t gov_delay(gov_t *g, uint32_t size);
+
+/**
+ * Add a sample of the pirates at a size, taken at the delay that
+ * gov_delay() returned for it.
+ *
+ * @param misses LLC misses of all pirates
+ * @param accesses LLC accesses of all pirates
+ */
+void gov_add(gov_t *g, uint32_t size, uint64_t misses, uint64_t accesses);
+
+/**
+ * Print the delay, search interval and fetch ratio of every size.
+ */
+void gov_print(FILE *out, const gov_t *g);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <ostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+using namespace std;
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#include "expect.h"
+#include "perf_columnar.h"
+#include "perf_pb.pb.h"
+
+typedef struct {
+	/* Column major, n_cols columns of block_rows values */
+	vector<uint64_t> data;
+	uint32_t n_rows;
+	uint32_t first_cycle;
+	uint32_t last_cycle;
+} col_block_t;
+
+static int block_rows = COL_DEFAULT_BLOCK_ROWS;
+static int n_cols = 0;
+/* Metric columns follow the counter columns */
+static int n_metric_cols = 0;
+static map<uint32_t, col_block_t> blocks;
+static vector<col_index_entry_t> col_index;
+
+enum {
+	COL_CYCLE = 0,
+	COL_SIZE,
+	COL_TIME,
+	COL_SIZE_TIME,
+	COL_SCHEDULE,
+	COL_HEAT_TIME,
+	COL_PHASE,
+	COL_GROUP,
+	COL_BANDIT_RATE,
+	COL_PIRATE_DELAY,
+	COL_FIRST_CTR,
+};
+
+void
+col_initialize(PerfHeader *header, ctr_list_t *t_ctrs,
+	       ctr_list_t *p_ctrs, int n_pirates, ctr_list_t *b_ctrs,
+	       int n_bandits, const metric_t *metrics,
+	       int n_metrics, int rows)
+{
+	PerfHeader::Columnar *columnar = header->mutable_columnar();
+
+	block_rows = rows;
+	columnar->set_block_rows(block_rows);
+
+	columnar->add_column("cycle");
+	columnar->add_column("size");
+	columnar->add_column("time");
+	columnar->add_column("size_time");
+	columnar->add_column("schedule");
+	columnar->add_column("heat_time");
+	columnar->add_column("phase");
+	columnar->add_column("group");
+	columnar->add_column("bandit_rate");
+	columnar->add_column("pirate_delay");
+	for (ctr_t *cur = t_ctrs->head; cur; cur = cur->next)
+		columnar->add_column(string("t:") + cur->event_name);
+	for (int j = 0; j < n_pirates; j++) {
+		for (ctr_t *cur = p_ctrs->head; cur; cur = cur->next) {
+			ostringstream name;
+			name << "p" << j << ":" << cur->event_name;
+			columnar->add_column(name.str());
+		}
+	}
+	for (int j = 0; j < n_bandits; j++) {
+		ostringstream prefix;
+		prefix << "b" << j << ":";
+		for (ctr_t *cur = b_ctrs->head; cur; cur = cur->next)
+			columnar->add_column(prefix.str() + cur->event_name);
+		columnar->add_column(prefix.str() + "bytes");
+	}
+	for (int i = 0; i < n_metrics; i++)
+		columnar->add_column(string("m:") + metrics[i].name);
+
+	n_metric_cols = n_metrics;
+	n_cols = columnar->column_size();
+}
+
+void
+col_begin(ostream &out)
+{
+	static const char zero[8] = { 0 };
+	const long pos = out.tellp();
+
+	if (pos % 8)
+		out.write(zero, 8 - pos % 8);
+}
+
+static void
+col_write_le64(ostream &out, const uint64_t *val, size_t n)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	out.write((const char *)val, n * sizeof(uint64_t));
+#else
+	for (size_t i = 0; i < n; i++) {
+		const uint64_t le = htole64(val[i]);
+		out.write((const char *)&le, sizeof(le));
+	}
+#endif
+}
+
+static void
+col_flush_block(ostream &out, uint32_t p_size, col_block_t *block)
+{
+	col_index_entry_t entry;
+	col_block_head_t head;
+
+	if (!block->n_rows)
+		return;
+
+	entry.offset = htole64(out.tellp());
+	entry.n_rows = htole32(block->n_rows);
+	entry.p_size = htole32(p_size);
+	entry.first_cycle = htole32(block->first_cycle);
+	entry.last_cycle = htole32(block->last_cycle);
+	col_index.push_back(entry);
+
+	head.n_rows = htole32(block->n_rows);
+	head.n_cols = htole32(n_cols);
+	out.write((const char *)&head, sizeof(head));
+
+	for (int c = 0; c < n_cols; c++)
+		col_write_le64(out, &block->data[(size_t)c * block_rows],
+			       block->n_rows);
+
+	block->n_rows = 0;
+}
+
+void
+col_write_sample(ostream &out, const sample_info_t *info, const uint64_t *ctr,
+		 const double *metric)
+{
+	col_block_t &block = blocks[info->p_size];
+
+	if (block.data.empty())
+		block.data.resize((size_t)n_cols * block_rows);
+
+	if (block.n_rows == 0)
+		block.first_cycle = info->cycle;
+	block.last_cycle = info->cycle;
+
+	const uint32_t row = block.n_rows++;
+	block.data[(size_t)COL_CYCLE * block_rows + row] = info->cycle;
+	block.data[(size_t)COL_SIZE * block_rows + row] = info->t_size;
+	block.data[(size_t)COL_TIME * block_rows + row] = info->time;
+	block.data[(size_t)COL_SIZE_TIME * block_rows + row] = info->size_time;
+	block.data[(size_t)COL_SCHEDULE * block_rows + row] = info->schedule;
+	block.data[(size_t)COL_HEAT_TIME * block_rows + row] = info->heat_time;
+	block.data[(size_t)COL_PHASE * block_rows + row] = info->phase;
+	block.data[(size_t)COL_GROUP * block_rows + row] = info->group;
+	block.data[(size_t)COL_BANDIT_RATE * block_rows + row] = info->bandit_rate;
+	block.data[(size_t)COL_PIRATE_DELAY * block_rows + row] = info->pirate_delay;
+	for (int c = COL_FIRST_CTR; c < n_cols - n_metric_cols; c++)
+		block.data[(size_t)c * block_rows + row] = *ctr++;
+	for (int c = n_cols - n_metric_cols; c < n_cols; c++)
+		memcpy(&block.data[(size_t)c * block_rows + row], metric++,
+		       sizeof(uint64_t));
+
+	if (block.n_rows == (uint32_t)block_rows)
+		col_flush_block(out, info->p_size, &block);
+}
+
+void
+col_finalize(ostream &out)
+{
+	col_trailer_t trailer;
+
+	for (map<uint32_t, col_block_t>::iterator it = blocks.begin();
+	     it != blocks.end(); ++it)
+		col_flush_block(out, it->first, &it->second);
+
+	trailer.index_offset = htole64(out.tellp());
+	trailer.n_entries = htole64(col_index.size());
+	memcpy(trailer.magic, COL_INDEX_MAGIC, sizeof(trailer.magic));
+
+	if (!col_index.empty())
+		out.write((const char *)&col_index[0],
+			  col_index.size() * sizeof(col_index_entry_t));
+	out.write((const char *)&trailer, sizeof(trailer));
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Columnar PIRATEv2 output.
+ *
+ * File layout, all integers little-endian:
+ *
+ *   "PIRATEv2"
+ *   uint32_t length, PerfHeader      Same as PIRATEv1, the header's
+ *                                    columnar field names the columns.
+ *   padding to 8 bytes
+ *   block*
+ *   index_entry[n_entries]
+ *   trailer
+ *
+ * Samples are grouped in blocks by pirate size. A block is a
+ * block_head followed by n_cols columns of n_rows uint64_t values
+ * each. The index has one entry per block, and the trailer at the
+ * very end of the file locates the index.
+ */
+
+#ifndef PERF_COLUMNAR_H
+#define PERF_COLUMNAR_H
+
+#include <ostream>
+#include <stdint.h>
+
+#include "perf_common.h"
+#include "perf_metric.h"
+#include "perfpirate.h"
+
+class PerfHeader;
+
+#define COL_MAGIC "PIRATEv2"
+#define COL_INDEX_MAGIC "PIRIDXv2"
+#define COL_DEFAULT_BLOCK_ROWS 1024
+
+typedef struct {
+    uint32_t n_rows;
+    uint32_t n_cols;
+} col_block_head_t;
+
+typedef struct {
+    /* File offset of the block_head */
+    uint64_t offset;
+    uint32_t n_rows;
+    uint32_t p_size;
+    uint32_t first_cycle;
+    uint32_t last_cycle;
+} col_index_entry_t;
+
+typedef struct {
+    uint64_t index_offset;
+    uint64_t n_entries;
+    char magic[8];
+} col_trailer_t;
+
+/**
+ * Set up the column layout and describe it in the header.
+ *
+ * @param header Header to add the column description to. Must be
+ *               called before the header is written.
+ * @param t_ctrs Target counter list
+ * @param p_ctrs Counter list of the pirates
+ * @param n_pirates Number of pirate threads
+ * @param b_ctrs Counter list of the bandits
+ * @param n_bandits Number of bandwidth bandits, each has a column of
+ *                  the bytes it wrote after its counters
+ * @param metrics Derived metrics, stored as the bits of a double
+ * @param n_metrics Number of metrics
+ * @param block_rows Number of samples per block
+ */
+void col_initialize(PerfHeader *header, ctr_list_t *t_ctrs,
+                    ctr_list_t *p_ctrs, int n_pirates,
+                    ctr_list_t *b_ctrs, int n_bandits,
+                    const metric_t *metrics, int n_metrics, int block_rows);
+
+/**
+ * Pad the output after the header so that blocks are 8 byte aligned.
+ */
+void col_begin(std::ostream &out);
+
+/**
+ * Add a sample, blocks are written to out when they fill up.
+ *
+ * @param info Sample sizes and cycle
+ * @param ctr Target counter values followed by the counter values of
+ *            each pirate
+ * @param metric Value of each metric
+ */
+void col_write_sample(std::ostream &out, const sample_info_t *info,
+                      const uint64_t *ctr, const double *metric);
+
+/**
+ * Write all partial blocks, the index and the trailer.
+ */
+void col_finalize(std::ostream &out);
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
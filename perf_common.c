@@ -33,9 +33,15 @@
 #include <assert.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
 
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "perf_common.h"
 #include "expect.h"
@@ -57,8 +63,21 @@ typedef struct {
 #define MAP_HUGETLB     0x40000
 #endif 
 
-/* Round size (upwards) to the nearest multiple of 2 MiB */
-#define ROUND_U(x) (((x) + (1 << 21)) & ~((1 << 21) - 1))
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB    (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB    (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define MEM_2M (1UL << 21)
+#define MEM_1G (1UL << 30)
+
+/* Round size upwards to a multiple of page, a power of two */
+#define ROUND_PAGE(x, page) (((x) + (page) - 1) & ~((size_t)(page) - 1))
 
 struct perf_event_attr perf_base_attr = {
     .disabled = 0,
@@ -121,22 +140,212 @@ write_all(int fd, const void *buf, size_t size)
     return size;
 }
 
-void *
-mem_huge_alloc(size_t size)
+uint64_t
+lat_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+lat_stat_add(lat_stat_t *stat, uint64_t ns)
+{
+    if (stat->n == 0 || ns < stat->min)
+        stat->min = ns;
+    if (ns > stat->max)
+        stat->max = ns;
+    stat->sum += ns;
+    stat->n++;
+}
+
+void
+lat_stat_print(FILE *out, const char *name, const lat_stat_t *stat)
+{
+    if (!stat->n) {
+        fprintf(out, "%s: no samples\n", name);
+        return;
+    }
+    fprintf(out, "%s: n=%" PRIu64 " min=%.1fus mean=%.1fus max=%.1fus\n",
+            name, stat->n, stat->min / 1e3,
+            (double)stat->sum / stat->n / 1e3, stat->max / 1e3);
+}
+
+void
+futex_word_wait(futex_word_t *word, uint32_t val)
+{
+    for (int i = 0; i < FUTEX_SPIN_LIMIT; i++) {
+        if (__atomic_load_n(&word->val, __ATOMIC_ACQUIRE) != val)
+            return;
+        cpu_relax();
+    }
+
+    /* The sleeper count and the value are accessed in opposite
+     * order by the waker, sequential consistency makes sure that at
+     * least one of us sees the other. */
+    __atomic_add_fetch(&word->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&word->val, __ATOMIC_SEQ_CST) == val) {
+        if (syscall(SYS_futex, &word->val, FUTEX_WAIT_PRIVATE, val,
+                    NULL, NULL, 0) == -1)
+            EXPECT_ERRNO(errno == EAGAIN || errno == EINTR);
+    }
+    __atomic_sub_fetch(&word->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+futex_word_store(futex_word_t *word, uint32_t val)
+{
+    __atomic_store_n(&word->val, val, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&word->sleepers, __ATOMIC_SEQ_CST))
+        EXPECT_ERRNO(syscall(SYS_futex, &word->val, FUTEX_WAKE_PRIVATE,
+                             INT_MAX, NULL, NULL, 0) != -1);
+}
+
+size_t
+mem_page_size(const void *addr, size_t size)
+{
+    const unsigned long start = (unsigned long)addr;
+    unsigned long vma_start, vma_end;
+    unsigned long kernel_page = 0, anon_huge = 0;
+    int in_vma = 0;
+    char line[256];
+    FILE *f;
+
+    EXPECT_ERRNO(f = fopen("/proc/self/smaps", "r"));
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long val;
+
+        if (sscanf(line, "%lx-%lx ", &vma_start, &vma_end) == 2) {
+            if (in_vma)
+                break;
+            in_vma = start >= vma_start && start < vma_end;
+        } else if (!in_vma) {
+            continue;
+        } else if (sscanf(line, "KernelPageSize: %lu kB", &val) == 1) {
+            kernel_page = val << 10;
+        } else if (sscanf(line, "AnonHugePages: %lu kB", &val) == 1) {
+            anon_huge = val << 10;
+        }
+    }
+    fclose(f);
+
+    if (!in_vma || start + size > vma_end)
+        return 0;
+    /* THP shows up as small pages in KernelPageSize */
+    if (kernel_page < MEM_2M && anon_huge >= ROUND_PAGE(size, MEM_2M))
+        return MEM_2M;
+    return kernel_page;
+}
+
+static int
+mem_hugetlb_alloc(mem_huge_t *mem, size_t size, size_t page, int flags)
+{
+    mem->map_size = ROUND_PAGE(size, page);
+    mem->map = mmap(NULL, mem->map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | flags,
+                    -1, 0);
+    if (mem->map == MAP_FAILED)
+        return -1;
+
+    mem->addr = mem->map;
+    mem->method = "hugetlb";
+    return 0;
+}
+
+static int
+mem_thp_alloc(mem_huge_t *mem, size_t size)
+{
+    const long small_page = sysconf(_SC_PAGESIZE);
+    char *addr;
+
+    /* Over-allocate so that the memory can start on a huge page */
+    mem->map_size = ROUND_PAGE(size, MEM_2M) + MEM_2M;
+    mem->map = mmap(NULL, mem->map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem->map == MAP_FAILED)
+        return -1;
+
+    mem->addr = (void *)ROUND_PAGE((unsigned long)mem->map, MEM_2M);
+    mem->method = "thp";
+    /* Fails if THP is disabled, the memory is then backed by small
+     * pages, which mem_page_size() reports */
+    madvise(mem->addr, ROUND_PAGE(size, MEM_2M), MADV_HUGEPAGE);
+
+    /* MAP_POPULATE would fault in the pages before the madvise(),
+     * populate them afterwards instead */
+    addr = mem->addr;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(addr, ROUND_PAGE(size, MEM_2M), MADV_POPULATE_WRITE) == 0)
+        return 0;
+#endif
+    for (size_t i = 0; i < ROUND_PAGE(size, MEM_2M); i += small_page)
+        ((volatile char *)addr)[i] = 0;
+
+    return 0;
+}
+
+int
+mem_huge_alloc(mem_huge_t *mem, size_t size, mem_pages_t policy)
+{
+    memset(mem, 0, sizeof(*mem));
+
+    if (policy == MEM_PAGES_AUTO || policy == MEM_PAGES_1G) {
+        if (mem_hugetlb_alloc(mem, size, MEM_1G, MAP_HUGE_1GB) == 0 ||
+            policy == MEM_PAGES_1G)
+            goto out;
+    }
+    if (policy == MEM_PAGES_AUTO || policy == MEM_PAGES_2M) {
+        if (mem_hugetlb_alloc(mem, size, MEM_2M, MAP_HUGE_2MB) == 0 ||
+            policy == MEM_PAGES_2M)
+            goto out;
+    }
+    mem_thp_alloc(mem, size);
+
+out:
+    if (mem->map == MAP_FAILED) {
+        mem->map = NULL;
+        return -1;
+    }
+    mem->page_size = mem_page_size(mem->addr, size);
+    return 0;
+}
+
+int
+mem_phys_pages(const void *addr, size_t size, uint64_t *phys)
 {
-    void *ptr;
-    ptr = mmap(NULL, ROUND_U(size),
-           PROT_READ | PROT_WRITE,
-           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
-           -1, 0);
+    const long page = sysconf(_SC_PAGESIZE);
+    const size_t first = (unsigned long)addr / page;
+    const size_t n_pages = (size + page - 1) / page;
+    int fd, ret = -1;
 
-    return ptr == MAP_FAILED ? NULL : ptr;
+    if ((fd = open("/proc/self/pagemap", O_RDONLY)) == -1)
+        return -1;
+    if (pread(fd, phys, n_pages * sizeof(*phys), first * sizeof(*phys)) !=
+        (ssize_t)(n_pages * sizeof(*phys)))
+        goto out;
+
+    for (size_t i = 0; i < n_pages; i++) {
+        /* Bit 63 is present, bits 0-54 the frame number, which reads
+         * as 0 without CAP_SYS_ADMIN */
+        const uint64_t pfn = phys[i] & ((1ULL << 55) - 1);
+
+        if (!(phys[i] >> 63) || !pfn)
+            goto out;
+        phys[i] = pfn * page;
+    }
+    ret = 0;
+
+out:
+    close(fd);
+    return ret;
 }
 
 void
-mem_huge_free(void *addr, size_t size)
+mem_huge_free(mem_huge_t *mem)
 {
-    munmap(addr, ROUND_U(size));
+    if (mem->map)
+        munmap(mem->map, mem->map_size);
+    mem->map = mem->addr = NULL;
 }
 
 
@@ -154,6 +363,7 @@ ctr_create(const struct perf_event_attr *base_attr)
         ctr->attr = *base_attr;
 
     ctr->fd = -1;
+    ctr->page = NULL;
     ctr->next = NULL;
 
     return ctr;
@@ -165,7 +375,13 @@ ctr_attach(ctr_t *ctr, pid_t pid, int cpu, int group_fd, int flags)
 {
     assert(ctr->fd == -1);
 
+#ifdef PERF_ATTR_SIZE_VER5
+    /* The clockid field isn't part of the first published struct */
+    ctr->attr.size = ctr->attr.use_clockid ? PERF_ATTR_SIZE_VER5 :
+        PERF_ATTR_SIZE_VER0;
+#else
     ctr->attr.size = PERF_ATTR_SIZE_VER0;
+#endif
     ctr->fd = perf_event_open(&ctr->attr, pid, cpu, group_fd, flags);
 
     fprintf(stderr, "Name: %s Type: %d Config 0x%" PRIx64 " Config1 0x%" PRIx64 
@@ -180,6 +396,142 @@ ctr_attach(ctr_t *ctr, pid_t pid, int cpu, int group_fd, int flags)
     return ctr->fd;
 }
 
+int
+ctr_mmap(ctr_t *ctr)
+{
+    void *page;
+
+    assert(ctr->fd != -1 && !ctr->page);
+
+    page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                ctr->fd, 0);
+    if (page == MAP_FAILED) {
+        perror("Failed to map counter page");
+        return -1;
+    }
+    ctr->page = (struct perf_event_mmap_page *)page;
+
+#if defined(__i386__) || defined(__x86_64__)
+    return ctr->page->cap_user_rdpmc ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static inline uint64_t
+rdpmc(uint32_t counter)
+{
+    uint32_t low, high;
+
+    __asm__ volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+    return low | ((uint64_t)high << 32);
+}
+#endif
+
+uint64_t
+ctr_read_user(const ctr_t *ctr)
+{
+    volatile struct perf_event_mmap_page *pc = ctr->page;
+    uint32_t seq, idx;
+    uint64_t count;
+
+    /* See the description of perf_event_mmap_page in
+     * linux/perf_event.h */
+    do {
+        seq = pc->lock;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+        idx = pc->index;
+        count = pc->offset;
+#if defined(__i386__) || defined(__x86_64__)
+        if (pc->cap_user_rdpmc && idx) {
+            const int width = pc->pmc_width;
+            int64_t pmc = rdpmc(idx - 1);
+
+            /* Sign extend the pmc_width bit wide value */
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            count += pmc;
+        }
+#endif
+
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while (pc->lock != seq);
+
+    return count;
+}
+
+int
+perf_ring_open(perf_ring_t *ring, int fd, int data_pages)
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    void *base;
+
+    assert(data_pages > 0 && !(data_pages & (data_pages - 1)));
+
+    base = mmap(NULL, (1 + data_pages) * page_size,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Failed to map sample buffer");
+        return -1;
+    }
+
+    ring->page = (struct perf_event_mmap_page *)base;
+    ring->data = (char *)base + page_size;
+    ring->data_size = data_pages * page_size;
+    /* perf_event_header.size is 16 bits */
+    EXPECT(ring->tmp = malloc(1 << 16));
+
+    return 0;
+}
+
+void
+perf_ring_close(perf_ring_t *ring)
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    if (!ring->page)
+        return;
+
+    munmap(ring->page, page_size + ring->data_size);
+    free(ring->tmp);
+    ring->page = NULL;
+}
+
+int
+perf_ring_drain(perf_ring_t *ring, perf_ring_cb_t cb, void *data)
+{
+    struct perf_event_mmap_page *pc = ring->page;
+    const uint64_t mask = ring->data_size - 1;
+    uint64_t head, tail;
+    int n = 0;
+
+    head = __atomic_load_n(&pc->data_head, __ATOMIC_ACQUIRE);
+    tail = pc->data_tail;
+
+    while (tail < head) {
+        /* Records are 8 byte aligned, so a header never wraps */
+        const uint64_t offset = tail & mask;
+        const struct perf_event_header *hdr =
+            (const struct perf_event_header *)(ring->data + offset);
+
+        if (offset + hdr->size > ring->data_size) {
+            const size_t first = ring->data_size - offset;
+            memcpy(ring->tmp, ring->data + offset, first);
+            memcpy(ring->tmp + first, ring->data, hdr->size - first);
+            hdr = (const struct perf_event_header *)ring->tmp;
+        }
+
+        cb(hdr, data);
+        tail += hdr->size;
+        n++;
+    }
+
+    __atomic_store_n(&pc->data_tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
 int
 ctrs_attach(ctr_list_t *list, pid_t pid, int cpu, int flags)
 {
@@ -201,6 +553,10 @@ void
 ctrs_close(ctr_list_t *list)
 {
     for (ctr_t *cur = list->head; cur; cur = cur->next) {
+        if (cur->page) {
+            munmap(cur->page, sysconf(_SC_PAGESIZE));
+            cur->page = NULL;
+        }
         if (cur->fd != -1) {
             close(cur->fd);
             cur->fd = -1;
@@ -37,11 +37,19 @@
 #endif
 
 #include <argp.h> 
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef struct ctr {
     struct perf_event_attr attr;
     const char *event_name;
     int fd;
+    /* User page mapped by ctr_mmap(), NULL if not mapped */
+    struct perf_event_mmap_page *page;
     struct ctr *next;
 } ctr_t;
 
@@ -50,6 +58,21 @@ typedef struct {
     struct ctr *tail;
 } ctr_list_t;
 
+/**
+ * A perf event sample buffer mapped into our address space.
+ */
+typedef struct {
+    struct perf_event_mmap_page *page;
+    char *data;
+    /* Size of the data area, a power of two */
+    size_t data_size;
+    /* Bounce buffer for records that wrap around the data area */
+    char *tmp;
+} perf_ring_t;
+
+typedef void (*perf_ring_cb_t)(const struct perf_event_header *hdr,
+                               void *data);
+
 extern struct perf_event_attr perf_base_attr;
 extern ctr_list_t perf_ctrs;
 
@@ -58,8 +81,128 @@ extern long perf_argp_parse_long(const char *name, const char *arg,
 
 size_t write_all(int fd, const void *buf, size_t size);
 
-void *mem_huge_alloc(size_t size);
-void mem_huge_free(void *addr, size_t size);
+/**
+ * Hint to the CPU that we are busy-waiting.
+ */
+static inline void
+cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Running min/mean/max of a latency, in nanoseconds.
+ */
+typedef struct {
+    uint64_t n;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} lat_stat_t;
+
+/**
+ * Current time in nanoseconds (CLOCK_MONOTONIC).
+ */
+uint64_t lat_now(void);
+
+void lat_stat_add(lat_stat_t *stat, uint64_t ns);
+
+/**
+ * Print a one line summary of a latency statistic.
+ *
+ * @param out Output stream
+ * @param name Name printed in front of the summary
+ * @param stat Statistic to print
+ */
+void lat_stat_print(FILE *out, const char *name, const lat_stat_t *stat);
+
+/* Number of polls before a futex_word_wait() goes to sleep */
+#define FUTEX_SPIN_LIMIT 4096
+
+/**
+ * A 32 bit word that threads can wait on, first by spinning and then
+ * on a futex. The waker only makes a system call if someone sleeps.
+ */
+typedef struct {
+    volatile uint32_t val;
+    volatile uint32_t sleepers;
+} futex_word_t;
+
+/**
+ * Wait while word->val == val. Spins FUTEX_SPIN_LIMIT times with PAUSE
+ * before sleeping on a futex.
+ */
+void futex_word_wait(futex_word_t *word, uint32_t val);
+
+/**
+ * Store val in the word and wake all threads waiting on it.
+ */
+void futex_word_store(futex_word_t *word, uint32_t val);
+
+typedef enum {
+    /* 1 GiB hugetlb, then 2 MiB hugetlb, then transparent huge pages */
+    MEM_PAGES_AUTO = 0,
+    MEM_PAGES_1G,
+    MEM_PAGES_2M,
+    MEM_PAGES_THP,
+} mem_pages_t;
+
+typedef struct {
+    void *addr;
+    /* Mapping that contains addr, larger than the allocation when it
+     * had to be aligned for THP */
+    void *map;
+    size_t map_size;
+    /* Page size backing all of the allocation, from /proc/self/smaps */
+    size_t page_size;
+    /* "hugetlb" or "thp" */
+    const char *method;
+} mem_huge_t;
+
+/**
+ * Allocate memory backed by huge pages, trying the page sizes of the
+ * policy in order. Transparent huge pages are the last resort, they
+ * always succeed, but the memory may end up backed by small pages.
+ * Check mem->page_size.
+ *
+ * @return 0 on success, -1 and errno set on error.
+ */
+int mem_huge_alloc(mem_huge_t *mem, size_t size, mem_pages_t policy);
+void mem_huge_free(mem_huge_t *mem);
+
+/**
+ * Page size backing [addr, addr + size) according to
+ * /proc/self/smaps. Transparent huge pages only count if they back
+ * the whole range.
+ *
+ * @return Page size in bytes, 0 if the range isn't mapped.
+ */
+size_t mem_page_size(const void *addr, size_t size);
+
+/**
+ * Physical address of every page in [addr, addr + size), from
+ * /proc/self/pagemap. The pages must be present.
+ *
+ * @param phys One entry per page of sysconf(_SC_PAGESIZE) bytes
+ *
+ * @return 0 on success, -1 if pagemap can't be read or hides the
+ *         frame numbers, which needs CAP_SYS_ADMIN.
+ */
+int mem_phys_pages(const void *addr, size_t size, uint64_t *phys);
+
+static inline const char *
+mem_pages_name(mem_pages_t policy)
+{
+    switch (policy) {
+    case MEM_PAGES_AUTO: return "auto";
+    case MEM_PAGES_1G: return "1g";
+    case MEM_PAGES_2M: return "2m";
+    case MEM_PAGES_THP: return "thp";
+    }
+    return "unknown";
+}
 
 /**
  * Create a counter structure and initialize the attributes structure with base_attr.
@@ -85,8 +228,56 @@ ctr_t *ctr_create(const struct perf_event_attr *base_attr);
 int ctr_attach(ctr_t *ctr, pid_t pid, int cpu, int group_fd, int flags);
 
 
+/**
+ * Map the user page of an attached counter, this allows the counter to
+ * be read from user space with ctr_read_user().
+ *
+ * @param ctr Attached counter
+ *
+ * @return 1 if the counter can be read with rdpmc, 0 if the page was
+ *         mapped but rdpmc isn't available, -1 on error.
+ */
+int ctr_mmap(ctr_t *ctr);
+
+/**
+ * Read a counter mapped with ctr_mmap() using rdpmc. Must be called
+ * from the thread the counter is attached to, and only if ctr_mmap()
+ * returned 1.
+ */
+uint64_t ctr_read_user(const ctr_t *ctr);
+
+/**
+ * Map the sample buffer of an attached counter.
+ *
+ * @param ring Ring to initialize
+ * @param fd Counter fd
+ * @param data_pages Size of the data area in pages, must be a power
+ *                   of two.
+ *
+ * @return 0 on success, -1 on error
+ */
+int perf_ring_open(perf_ring_t *ring, int fd, int data_pages);
+
+/**
+ * Unmap a sample buffer mapped with perf_ring_open().
+ */
+void perf_ring_close(perf_ring_t *ring);
+
+/**
+ * Call cb for every record in the sample buffer and hand the space
+ * back to the kernel.
+ *
+ * @param ring Sample buffer
+ * @param cb Callback called with each record
+ * @param data Data passed to the callback
+ *
+ * @return Number of records consumed
+ */
+int perf_ring_drain(perf_ring_t *ring, perf_ring_cb_t cb, void *data);
+
 /**
  * Close all counters in a list. Counters with fd == -1 are ignored.
+ * Mapped user pages are unmapped.
  */
 void ctrs_close(ctr_list_t *list);
 
@@ -185,6 +376,9 @@ void setup_ctr(const char *event, ctr_list_t *ctrs_list);
  */
 void setup_raw_ctr(const char *event, ctr_list_t *ctrs_list);
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 
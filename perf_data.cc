@@ -32,15 +32,25 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 using namespace std;
 
 #include <stdint.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
+#include "expect.h"
 #include "perfpirate.h"
 #include "perf_data.h"
 #include "perf_common.h"
+#include "perf_columnar.h"
+#include "perf_pbdump.h"
+#include "perf_summary.h"
+#include "pirate_kernels.h"
 #include "perf_pb.pb.h"
 
 
@@ -49,6 +59,62 @@ static fstream dumpfile;
 static int n_pirates;
 static int n_t_ctrs = 0;
 static int n_p_ctrs = 0;
+/* Target counters are multiplexed, samples are tagged with a group */
+static bool t_groups = false;
+static output_format_t format = OUTPUT_PROTOBUF;
+/* --summary and --no-raw */
+static const char *summary_file = NULL;
+static int summary_interval = 0;
+static bool raw_output = true;
+/* --metric, evaluated by the writer */
+static const metric_t *metrics = NULL;
+static int n_metrics = 0;
+static vector<double> metric_val;
+/* Bandwidth bandits, see pb_set_bandits() */
+static int n_bandits = 0;
+static int n_b_ctrs = 0;
+static const int *bandit_cpus = NULL;
+static ctr_list_t *bandit_ctrs = NULL;
+static uint64_t bandit_size = 0;
+static const uint32_t *bandit_rates = NULL;
+static int n_bandit_rates = 0;
+
+/*
+ * Samples are handed from the signal handling path to a writer
+ * thread through a single-producer/single-consumer ring of fixed
+ * size slots. The producer only copies raw counter values, the
+ * writer does the protobuf serialization and file I/O.
+ */
+typedef struct {
+	sample_info_t info;
+	uint64_t ctr[];
+} dump_slot_t;
+
+static struct {
+	/* Written by the producer */
+	volatile uint64_t head __attribute__((aligned(64)));
+	/* Written by the writer thread */
+	volatile uint64_t tail __attribute__((aligned(64)));
+	volatile int stop;
+
+	char *slots __attribute__((aligned(64)));
+	size_t slot_size;
+	uint64_t n_slots;
+
+	int drop_when_full;
+	uint64_t dropped;
+	uint64_t written;
+	lat_stat_t stall;
+
+	pthread_t thread;
+} ring = {
+	0, 0, 0,
+	NULL, 0, DEFAULT_WRITER_SLOTS,
+	0, 0, 0, { 0, 0, 0, 0 },
+	0,
+};
+
+static void pb_writer_start(const int t_cpu, pirate_pthread_conf_t *pth_conf);
 
 void
 pb_ctr_fill(PerfCtrInfo *pb_ctr, ctr_t *ctr, const int id)
@@ -72,7 +138,9 @@ pb_initialize_pirate(pirate_conf_t *conf, pirate_pthread_conf_t *pth_conf,
 	p_setup->set_way_size(conf->way_size);
 	p_setup->set_no_sweep(conf->no_sweep);
 	p_setup->set_n_pirates(n_pirates);
-	
+	p_setup->set_sweep_start(conf->sweep_start);
+	p_setup->set_sweep_step(conf->sweep_step);
+	pb_write_kernel(conf);
 
 	for (ctr_t *cur = pirate_ctrs->head; cur; cur = cur->next) {
 		PerfCtrInfo *pb_cur = p_setup->add_ctr();
@@ -86,6 +154,24 @@ pb_initialize_pirate(pirate_conf_t *conf, pirate_pthread_conf_t *pth_conf,
 
 }
 
+void
+pb_initialize_bandits()
+{
+	PerfHeader::BanditSetup *b_setup = header.mutable_b_setup();
+
+	for (int i = 0; i < n_bandits; i++)
+		b_setup->add_cpu(bandit_cpus[i]);
+	b_setup->set_size(bandit_size);
+	for (ctr_t *cur = bandit_ctrs->head; cur; cur = cur->next) {
+		PerfCtrInfo *pb_cur = b_setup->add_ctr();
+		pb_ctr_fill(pb_cur, cur, n_b_ctrs);
+		n_b_ctrs++;
+	}
+	b_setup->set_n_ctrs(n_b_ctrs);
+	for (int i = 0; i < n_bandit_rates; i++)
+		b_setup->add_rate(bandit_rates[i]);
+}
+
 void
 pb_initialize_target(const int cpu, const uint64_t sample_period, 
 		ctr_list_t *perf_ctrs, char **exec_argv, const int exec_argc)
@@ -124,12 +210,36 @@ pb_initialize(const int t_cpu, const int no_reference,
 	pb_initialize_target(t_cpu, sample_period, perf_ctrs, 
 							exec_argv, exec_argc);
 	pb_initialize_pirate(conf, pth_conf, pirate_ctrs);
+	if (n_bandits)
+		pb_initialize_bandits();
 
 	header.set_no_reference(no_reference);
 
-	dumpfile.open(pb_output_name, ios::out | ios::trunc | ios::binary);
-	dumpfile << "PIRATEv1";
+	for (int i = 0; i < n_metrics; i++) {
+		PerfHeader::Metric *metric = header.add_metric();
+		metric->set_name(metrics[i].name);
+		metric->set_expr(metrics[i].expr);
+	}
+	metric_val.resize(n_metrics);
+
+	if (summary_file)
+		sum_initialize(summary_file, n_t_ctrs, n_pirates, n_p_ctrs,
+			       n_bandits, n_b_ctrs, metrics, n_metrics,
+			       summary_interval);
+
+	if (raw_output) {
+		if (format == OUTPUT_COLUMNAR)
+			col_initialize(&header, perf_ctrs, pirate_ctrs,
+				       n_pirates, bandit_ctrs, n_bandits,
+				       metrics, n_metrics,
+				       COL_DEFAULT_BLOCK_ROWS);
+
+		dumpfile.open(pb_output_name,
+			      ios::out | ios::trunc | ios::binary);
+		dumpfile << (format == OUTPUT_COLUMNAR ? COL_MAGIC : "PIRATEv1");
+	}
 
+	pb_writer_start(t_cpu, pth_conf);
 }
 
 extern "C" void
@@ -150,38 +260,418 @@ pb_write_reference(read_format_t *r_data, int r_size){
 	assert(ref->ctr_size() == n_p_ctrs);
 }
 
+extern "C" void
+pb_write_kernel_reference(const char *kernel, read_format_t *r_data,
+			  int r_size)
+{
+	PerfHeader::KernelReference *ref = header.add_kernel_reference();
+	ref->set_kernel(kernel);
+	PerfCtrSample *sample = ref->mutable_sample();
+	sample->set_size(r_size);
+	for(int i = 0; i < n_p_ctrs; i++)
+		sample->add_ctr(r_data->ctr[i].val);
+}
+
+extern "C" void
+pb_write_kernel(const pirate_conf_t *conf)
+{
+	PerfHeader::PirateSetup *p_setup = header.mutable_p_setup();
+	p_setup->set_kernel(pirate_kernel_name(conf->kernel));
+	if (conf->kernel == PIRATE_KERNEL_MLP) {
+		const pirate_variant_t *v = pirate_variant(conf->variant);
+		p_setup->set_streams(v->streams);
+		p_setup->set_isa(v->isa);
+		p_setup->set_variant(v->name);
+	} else {
+		p_setup->clear_streams();
+		p_setup->clear_isa();
+		p_setup->clear_variant();
+	}
+}
+
+extern "C" void
+pb_write_calibration(const char *kernel, double access_rate, int passes,
+		     uint64_t time)
+{
+	PerfHeader::Calibration *cal =
+		header.mutable_p_setup()->add_calibration();
+	cal->set_kernel(kernel);
+	cal->set_access_rate(access_rate);
+	cal->set_passes(passes);
+	cal->set_time(time);
+}
+
+extern "C" void
+pb_write_pages(const char *method, uint64_t page_size)
+{
+	PerfHeader::PirateSetup *p_setup = header.mutable_p_setup();
+	p_setup->set_page_size(page_size);
+	p_setup->set_page_alloc(method);
+}
+
+extern "C" void
+pb_write_color(int physical)
+{
+	header.mutable_p_setup()->set_color_physical(physical);
+}
+
+extern "C" void
+pb_write_slices(int slices, int tested_sets, const uint32_t *occupancy, int n)
+{
+	PerfHeader::Slices *s = header.mutable_p_setup()->mutable_slices();
+	s->set_slices(slices);
+	s->set_tested_sets(tested_sets);
+	for (int i = 0; i < n; i++)
+		s->add_occupancy(occupancy[i]);
+}
+
+extern "C" void
+pb_write_governor(double threshold, double loops_per_ns)
+{
+	PerfHeader::PirateSetup *p_setup = header.mutable_p_setup();
+	p_setup->set_governor(threshold);
+	p_setup->set_delay_loops_per_ns(loops_per_ns);
+}
+
+extern "C" void
+pb_write_heat(int converge, uint64_t heat_time, uint64_t window)
+{
+	PerfHeader::TargetSetup *t_setup = header.mutable_t_setup();
+	t_setup->set_heat_time(heat_time);
+	t_setup->set_heat_converge(converge);
+	if (converge)
+		t_setup->set_heat_window(window);
+}
+
+extern "C" void
+pb_write_discard(uint64_t insns)
+{
+	header.mutable_t_setup()->set_discard(insns);
+}
+
+extern "C" void
+pb_write_ctr_group(int id, const int *idx, int n)
+{
+	PerfHeader::CtrGroup *group = header.mutable_t_setup()->add_group();
+	group->set_id(id);
+	t_groups = true;
+	for (int i = 0; i < n; i++)
+		group->add_ctr(idx[i]);
+}
+
+extern "C" void
+pb_write_schedule(const char *name, uint64_t seed, const uint32_t *sizes,
+		  int n_sizes, uint32_t heat_drop)
+{
+	PerfHeader::PirateSetup *p_setup = header.mutable_p_setup();
+	p_setup->set_schedule(name);
+	if (!strcmp(name, "random"))
+		p_setup->set_schedule_seed(seed);
+	for (int i = 0; i < n_sizes; i++)
+		p_setup->add_schedule_size(sizes[i]);
+	p_setup->set_heat_drop(heat_drop);
+}
+
+extern "C" void
+pb_write_adaptive(double ci_width, uint32_t min_samples, uint32_t min_step,
+		  const char *metric)
+{
+	PerfHeader::Adaptive *a = header.mutable_adaptive();
+	a->set_ci_width(ci_width);
+	a->set_min_samples(min_samples);
+	a->set_min_step(min_step);
+	a->set_metric(metric);
+}
+
 extern "C" void
 pb_header2file()
 {
-	uint32_t size = header.ByteSize();
-	dumpfile.write((char *)&size, sizeof(size));
-	header.SerializeToOstream(&dumpfile);
+	if (summary_file)
+		sum_set_header(header);
+	if (raw_output) {
+		uint32_t size = header.ByteSizeLong();
+		dumpfile.write((char *)&size, sizeof(size));
+		header.SerializeToOstream(&dumpfile);
+		if (format == OUTPUT_COLUMNAR)
+			col_begin(dumpfile);
+		else
+			pbd_initialize(n_t_ctrs, n_pirates, n_p_ctrs, n_bandits,
+				       n_b_ctrs, n_metrics, t_groups);
+	}
 	header.Clear();
 }
 
 
+/* Read one length prefixed message, false at the end of the file */
+static bool
+pb_read_message(istream &in, google::protobuf::Message &msg)
+{
+	uint32_t size;
+	std::string buf;
+
+	if (!in.read((char *)&size, sizeof(size)))
+		return false;
+	buf.resize(size);
+	EXPECT(in.read(&buf[0], size));
+	EXPECT(msg.ParseFromString(buf));
+	return true;
+}
+
+static void
+pb_write_message(ostream &out, const google::protobuf::Message &msg)
+{
+	const size_t len = msg.ByteSizeLong();
+	const uint32_t size = len;
+
+	/* The length prefix is 32 bits */
+	EXPECT(size == len);
+	out.write((char *)&size, sizeof(size));
+	EXPECT(msg.SerializeToOstream(&out));
+}
 
 extern "C" void
-pb_dump_sample(read_format_t **data_array, int t_size, int p_size)
+pb_merge_domains(const char *pb_output_name, char **domain_files,
+		 const int n_domains)
+{
+	fstream out(pb_output_name, ios::out | ios::trunc | ios::binary);
+	std::vector<ifstream> in(n_domains);
+	PerfHeader merged;
+
+	EXPECT(out);
+	out << "PIRATEv1";
+
+	for (int d = 0; d < n_domains; d++) {
+		PerfHeader d_header;
+		char magic[8];
+
+		in[d].open(domain_files[d], ios::in | ios::binary);
+		EXPECT(in[d]);
+		EXPECT(in[d].read(magic, sizeof(magic)));
+		EXPECT(!memcmp(magic, "PIRATEv1", sizeof(magic)));
+		EXPECT(pb_read_message(in[d], d_header));
+
+		if (d == 0)
+			merged = d_header;
+
+		PerfHeader::Domain *domain = merged.add_domain();
+		domain->set_domain(d);
+		domain->set_t_cpu(d_header.t_setup().cpu());
+		domain->mutable_p_cpu()->CopyFrom(d_header.p_setup().cpu());
+		domain->set_sweep_start(d_header.p_setup().sweep_start());
+		domain->set_sweep_step(d_header.p_setup().sweep_step());
+		if (d_header.has_reference())
+			domain->mutable_reference()->CopyFrom(d_header.reference());
+	}
+	pb_write_message(out, merged);
+
+	for (int d = 0; d < n_domains; d++) {
+		PerfCtrDump dump;
+
+		while (pb_read_message(in[d], dump)) {
+			dump.set_domain(d);
+			pb_write_message(out, dump);
+		}
+		in[d].close();
+	}
+
+	EXPECT(out.flush());
+	out.close();
+}
+
+static void *
+pb_writer_main(void *arg)
+{
+	while (1) {
+		const uint64_t tail = ring.tail;
+		const uint64_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+
+		if (tail == head) {
+			if (__atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE) &&
+			    head == __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE))
+				break;
+			if (raw_output && format == OUTPUT_PROTOBUF)
+				pbd_flush(dumpfile);
+			usleep(WRITER_IDLE_USEC);
+			continue;
+		}
+
+		for (uint64_t i = tail; i != head; i++) {
+			const dump_slot_t *slot = (dump_slot_t *)
+				&ring.slots[(i & (ring.n_slots - 1)) * ring.slot_size];
+			for (int m = 0; m < n_metrics; m++)
+				metric_val[m] = metric_eval(&metrics[m], slot->ctr,
+							    n_t_ctrs, n_pirates,
+							    n_p_ctrs);
+			if (summary_file)
+				sum_add_sample(&slot->info, slot->ctr);
+			if (raw_output && format == OUTPUT_COLUMNAR)
+				col_write_sample(dumpfile, &slot->info, slot->ctr,
+						 n_metrics ? &metric_val[0] : NULL);
+			else if (raw_output)
+				pbd_write_sample(dumpfile, &slot->info, slot->ctr,
+						 n_metrics ? &metric_val[0] : NULL);
+			ring.written++;
+			/* Hand the slot back as soon as it has been consumed */
+			__atomic_store_n(&ring.tail, i + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	if (raw_output && format == OUTPUT_PROTOBUF)
+		pbd_flush(dumpfile);
+	dumpfile.flush();
+	return NULL;
+}
+
+/**
+ * Pin the writer thread to a CPU that is neither used by the target
+ * nor by any of the pirates. The thread is left unpinned if there is
+ * no such CPU.
+ */
+static void
+pb_writer_pin(const int t_cpu, pirate_pthread_conf_t *pth_conf)
+{
+	cpu_set_t cpu_set;
+
+	EXPECT_ERRNO(sched_getaffinity(0, sizeof(cpu_set_t), &cpu_set) == 0);
+	CPU_CLR(t_cpu, &cpu_set);
+	for (int i = 0; i < n_pirates; i++)
+		CPU_CLR(pth_conf[i].cpu, &cpu_set);
+	for (int i = 0; i < n_bandits; i++)
+		CPU_CLR(bandit_cpus[i], &cpu_set);
+
+	if (CPU_COUNT(&cpu_set) == 0) {
+		fprintf(stderr, "Warning: No free CPU for the writer thread, "
+			"leaving it unpinned.\n");
+		return;
+	}
+	EXPECT(pthread_setaffinity_np(ring.thread, sizeof(cpu_set_t), &cpu_set) == 0);
+}
+
+static void
+pb_writer_start(const int t_cpu, pirate_pthread_conf_t *pth_conf)
+{
+	ring.slot_size = sizeof(dump_slot_t) +
+		sizeof(uint64_t) * (n_t_ctrs + n_pirates * n_p_ctrs +
+				    n_bandits * (n_b_ctrs + 1));
+	/* Keep slots cache line aligned */
+	ring.slot_size = (ring.slot_size + 63) & ~(size_t)63;
+
+	EXPECT(posix_memalign((void **)&ring.slots, 64,
+			      ring.n_slots * ring.slot_size) == 0);
+	memset(ring.slots, '\0', ring.n_slots * ring.slot_size);
+
+	EXPECT(pthread_create(&ring.thread, NULL, &pb_writer_main, NULL) == 0);
+	pb_writer_pin(t_cpu, pth_conf);
+}
+
+extern "C" void
+pb_set_writer(const int n_slots, const int drop_when_full)
+{
+	/* Round up to a power of two so that slots can be masked */
+	ring.n_slots = 1;
+	while (ring.n_slots < (uint64_t)n_slots)
+		ring.n_slots <<= 1;
+	ring.drop_when_full = drop_when_full;
+}
+
+extern "C" void
+pb_set_format(const output_format_t fmt)
+{
+	format = fmt;
+}
+
+extern "C" void
+pb_set_summary(const char *file, const int interval_sec, const int raw)
+{
+	summary_file = file;
+	summary_interval = interval_sec;
+	raw_output = raw;
+}
+
+extern "C" void
+pb_set_metrics(const metric_t *_metrics, const int _n_metrics)
+{
+	metrics = _metrics;
+	n_metrics = _n_metrics;
+}
+
+extern "C" void
+pb_set_bandits(const int *cpus, const int _n_bandits, ctr_list_t *ctrs,
+	       uint64_t size, const uint32_t *rates, const int n_rates)
+{
+	bandit_cpus = cpus;
+	n_bandits = _n_bandits;
+	bandit_ctrs = ctrs;
+	bandit_size = size;
+	bandit_rates = rates;
+	n_bandit_rates = n_rates;
+}
+
+extern "C" void
+pb_dump_sample(read_format_t **data_array, const sample_info_t *info)
 {	
-	PerfCtrDump dump;
-	
-	PerfCtrSample *t_samp = dump.mutable_t_sample();
+	const uint64_t head = ring.head;
+
+	if (head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) == ring.n_slots) {
+		if (ring.drop_when_full) {
+			ring.dropped++;
+			return;
+		}
+
+		/* Backpressure, wait for the writer to free a slot */
+		const uint64_t begin = lat_now();
+		while (head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) ==
+		       ring.n_slots)
+			cpu_relax();
+		lat_stat_add(&ring.stall, lat_now() - begin);
+	}
 
-	t_samp->set_size(t_size);
-	for(int i = 0; i < n_t_ctrs; i++)
-		t_samp->add_ctr(data_array[0]->ctr[i].val);
+	dump_slot_t *slot = (dump_slot_t *)
+		&ring.slots[(head & (ring.n_slots - 1)) * ring.slot_size];
+	uint64_t *ctr = slot->ctr;
 
-	for(int j = 0; j < n_pirates; j++){
-		PerfCtrSample *p_samp = dump.add_p_sample();
-		p_samp->set_size(p_size);
+	slot->info = *info;
+	for(int i = 0; i < n_t_ctrs; i++)
+		*ctr++ = data_array[0]->ctr[i].val;
+	for(int j = 0; j < n_pirates; j++)
 		for(int i = 0; i < n_p_ctrs; i++)
-			p_samp->add_ctr(data_array[j+1]->ctr[i].val);
+			*ctr++ = data_array[j+1]->ctr[i].val;
+	/* The bytes written follow the counters of each bandit */
+	for (int j = 0; j < n_bandits; j++)
+		for (int i = 0; i <= n_b_ctrs; i++)
+			*ctr++ = data_array[n_pirates + j + 1]->ctr[i].val;
+
+	__atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+}
+
+extern "C" void
+pb_finalize(const int print_stats)
+{
+	if (!ring.slots)
+		return;
+
+	__atomic_store_n(&ring.stop, 1, __ATOMIC_RELEASE);
+	EXPECT(pthread_join(ring.thread, NULL) == 0);
+	if (raw_output) {
+		if (format == OUTPUT_COLUMNAR)
+			col_finalize(dumpfile);
+		dumpfile.close();
+	}
+	if (summary_file)
+		sum_finalize();
+
+	if (ring.dropped)
+		fprintf(stderr, "Warning: Dropped %" PRIu64 " samples, "
+			"the writer could not keep up.\n", ring.dropped);
+	if (print_stats) {
+		fprintf(stderr, "Writer: %" PRIu64 " samples written, %" PRIu64
+			" dropped, %" PRIu64 " ring slots\n",
+			ring.written, ring.dropped, ring.n_slots);
+		lat_stat_print(stderr, "Writer backpressure stall", &ring.stall);
 	}
 
-	uint32_t size = dump.ByteSize();
-	dumpfile.write((char *)&size, sizeof(size));
-	dump.SerializeToOstream(&dumpfile);
+	free(ring.slots);
+	ring.slots = NULL;
 }
 
 
@@ -33,6 +33,7 @@
 #define PERF_DATA_H
 
 #include "perf_common.h"
+#include "perf_metric.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,10 +49,160 @@ void pb_debugHeader();
 
 void pb_write_reference(read_format_t *r_data, int r_size);
 
+/**
+ * Store the reference run of a pirate kernel other than the one used
+ * for the experiment.
+ */
+void pb_write_kernel_reference(const char *kernel, read_format_t *r_data,
+                               int r_size);
+
+/**
+ * Record the pirate kernel in the header. Called again once
+ * --pirate-kernel=auto has picked a kernel.
+ */
+void pb_write_kernel(const pirate_conf_t *conf);
+
+/**
+ * Record the access rate of a kernel variant measured by the autotuner.
+ */
+void pb_write_calibration(const char *kernel, double access_rate, int passes,
+			  uint64_t time);
+
+/**
+ * Record the pages backing the pirate data set.
+ *
+ * @param method How they were allocated, "hugetlb" or "thp"
+ * @param page_size Page size in bytes
+ */
+void pb_write_pages(const char *method, uint64_t page_size);
+
+/**
+ * Record whether the color kernel found the physical addresses of the
+ * data set.
+ */
+void pb_write_color(int physical);
+
+/**
+ * Record the LLC slice calibration of the color kernel.
+ *
+ * @param tested_sets Set indexes split with eviction tests, 0 if the
+ *                    calibration failed
+ * @param occupancy Pirate lines per slice at 1, 2, ... ways
+ */
+void pb_write_slices(int slices, int tested_sets, const uint32_t *occupancy,
+                     int n);
+
+/**
+ * Record the settings of the pirate intensity governor.
+ *
+ * @param threshold Highest fetch ratio of the pirates
+ * @param loops_per_ns Calibration of the pirates' delay loop
+ */
+void pb_write_governor(double threshold, double loops_per_ns);
+
+/**
+ * Record how the target is heated.
+ */
+void pb_write_heat(int converge, uint64_t heat_time, uint64_t window);
+
+/**
+ * Record the length of the discarded prefix after size changes.
+ */
+void pb_write_discard(uint64_t insns);
+
+/**
+ * Record a group of multiplexed target counters.
+ *
+ * @param id Group ID, as stored in the samples
+ * @param idx Index of every counter in the target counter list
+ * @param n Number of counters in the group
+ */
+void pb_write_ctr_group(int id, const int *idx, int n);
+
+/**
+ * Record the sweep schedule.
+ */
+void pb_write_schedule(const char *name, uint64_t seed, const uint32_t *sizes,
+                       int n_sizes, uint32_t heat_drop);
+
+/**
+ * Record the settings of an adaptive sweep.
+ */
+void pb_write_adaptive(double ci_width, uint32_t min_samples,
+                       uint32_t min_step, const char *metric);
+
 void pb_header2file();
 
+/**
+ * Merge the PIRATEv1 files of a --domains run into one file. The
+ * header is domain 0's header with a description of every domain,
+ * and every dump is tagged with its domain.
+ */
+void pb_merge_domains(const char *pb_output_name, char **domain_files,
+                      const int n_domains);
+
+
+/**
+ * Configure the sample writer thread. Must be called before
+ * pb_initialize().
+ *
+ * @param n_slots Number of samples that can be queued for the writer,
+ *                rounded up to a power of two.
+ * @param drop_when_full Drop samples when the queue is full instead of
+ *                       waiting for the writer.
+ */
+void pb_set_writer(const int n_slots, const int drop_when_full);
+
+/**
+ * Select the output format. Must be called before pb_initialize().
+ *
+ * @param format OUTPUT_PROTOBUF (PIRATEv1) or OUTPUT_COLUMNAR (PIRATEv2)
+ */
+void pb_set_format(const output_format_t format);
 
-void pb_dump_sample(read_format_t **data_array, int t_size, int p_size);
+/**
+ * Keep per-size statistics and write them to a summary file. Must be
+ * called before pb_initialize().
+ *
+ * @param file Summary file, see perf_summary.h
+ * @param interval_sec Seconds between summary writes, 0 for only at exit
+ * @param raw Also write every sample to the output file
+ */
+void pb_set_summary(const char *file, const int interval_sec, const int raw);
+
+/**
+ * Evaluate derived metrics for every sample and size. Must be called
+ * before pb_initialize(), and the metrics must stay valid until
+ * pb_finalize().
+ */
+void pb_set_metrics(const metric_t *metrics, const int n_metrics);
+
+/**
+ * Record bandwidth bandits in the samples. Must be called before
+ * pb_initialize(), and the counters and rates must stay valid until
+ * then.
+ *
+ * @param cpus CPU of every bandit
+ * @param ctrs Counters of the first bandit, every bandit has the same
+ * @param size Bytes that each bandit streams through
+ * @param rates Rates in MB/s that the bandits take turns at
+ */
+void pb_set_bandits(const int *cpus, const int n_bandits, ctr_list_t *ctrs,
+                    uint64_t size, const uint32_t *rates, const int n_rates);
+
+/**
+ * Queue a sample for the writer thread. Only the raw counter values
+ * are copied, data_array can be reused as soon as this returns.
+ * data_array holds the target, every pirate and then every bandit,
+ * whose counters are followed by the bytes it wrote.
+ */
+void pb_dump_sample(read_format_t **data_array, const sample_info_t *info);
+
+/**
+ * Drain all queued samples, stop the writer thread and close the
+ * output file.
+ */
+void pb_finalize(const int print_stats);
 
 #ifdef __cplusplus
 }
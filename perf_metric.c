@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "perf_metric.h"
+
+#define PIRATE_PREFIX "pirate."
+
+/* Recursive descent parser that emits stack code */
+typedef struct {
+    metric_t *m;
+    const char *pos;
+    ctr_list_t *t_ctrs;
+    ctr_list_t *p_ctrs;
+    char *err;
+    size_t err_len;
+    int failed;
+} parser_t;
+
+static void
+parse_error(parser_t *p, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (p->failed)
+        return;
+    p->failed = 1;
+
+    va_start(ap, fmt);
+    vsnprintf(p->err, p->err_len, fmt, ap);
+    va_end(ap);
+}
+
+static void
+emit(parser_t *p, metric_op_t op, int idx, double val)
+{
+    metric_insn_t *insn;
+
+    if (p->m->n_code == METRIC_MAX_CODE) {
+        parse_error(p, "Expression too long");
+        return;
+    }
+
+    insn = &p->m->code[p->m->n_code++];
+    insn->op = op;
+    insn->idx = idx;
+    insn->val = val;
+}
+
+static void
+skip_space(parser_t *p)
+{
+    while (isspace((unsigned char)*p->pos))
+        p->pos++;
+}
+
+static int
+is_ident(const char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == ':' || c == '.';
+}
+
+/* Event names may contain '-', so a '-' between two name characters
+ * is part of the name. A subtraction needs a space before its '-'. */
+static int
+is_ident_next(const char *pos)
+{
+    return is_ident(pos[0]) || (pos[0] == '-' && is_ident(pos[1]));
+}
+
+static int
+find_ctr(ctr_list_t *list, const char *name, size_t len)
+{
+    int idx = 0;
+
+    for (ctr_t *cur = list->head; cur; cur = cur->next, idx++)
+        if (strlen(cur->event_name) == len &&
+            !strncmp(cur->event_name, name, len))
+            return idx;
+    return -1;
+}
+
+static void parse_expr(parser_t *p);
+
+static void
+parse_counter(parser_t *p)
+{
+    const char *name = p->pos;
+    size_t len;
+    metric_op_t op = METRIC_TARGET;
+    ctr_list_t *list = p->t_ctrs;
+    int idx;
+
+    while (is_ident_next(p->pos))
+        p->pos++;
+    len = p->pos - name;
+
+    if (!strncmp(name, PIRATE_PREFIX, strlen(PIRATE_PREFIX))) {
+        name += strlen(PIRATE_PREFIX);
+        len -= strlen(PIRATE_PREFIX);
+        op = METRIC_PIRATE;
+        list = p->p_ctrs;
+    }
+
+    idx = find_ctr(list, name, len);
+    if (idx == -1) {
+        parse_error(p, "Unknown %s counter '%.*s'%s",
+                    op == METRIC_PIRATE ? "pirate" : "target",
+                    (int)len, name, memchr(name, '-', len) ?
+                    " (a subtraction needs spaces around '-')" : "");
+        return;
+    }
+    emit(p, op, idx, 0);
+}
+
+static void
+parse_factor(parser_t *p)
+{
+    skip_space(p);
+
+    if (*p->pos == '(') {
+        p->pos++;
+        parse_expr(p);
+        skip_space(p);
+        if (*p->pos != ')') {
+            parse_error(p, "Missing ')' at '%s'", p->pos);
+            return;
+        }
+        p->pos++;
+    } else if (*p->pos == '-') {
+        p->pos++;
+        parse_factor(p);
+        emit(p, METRIC_NEG, 0, 0);
+    } else if (isdigit((unsigned char)*p->pos) || *p->pos == '.') {
+        char *end;
+        const double val = strtod(p->pos, &end);
+
+        p->pos = end;
+        emit(p, METRIC_CONST, 0, val);
+    } else if (is_ident(*p->pos)) {
+        parse_counter(p);
+    } else {
+        parse_error(p, "Expected a counter, number or '(' at '%s'", p->pos);
+    }
+}
+
+static void
+parse_term(parser_t *p)
+{
+    parse_factor(p);
+    while (!p->failed) {
+        char op;
+
+        skip_space(p);
+        op = *p->pos;
+        if (op != '*' && op != '/')
+            break;
+        p->pos++;
+        parse_factor(p);
+        emit(p, op == '*' ? METRIC_MUL : METRIC_DIV, 0, 0);
+    }
+}
+
+static void
+parse_expr(parser_t *p)
+{
+    parse_term(p);
+    while (!p->failed) {
+        char op;
+
+        skip_space(p);
+        op = *p->pos;
+        if (op != '+' && op != '-')
+            break;
+        p->pos++;
+        parse_term(p);
+        emit(p, op == '+' ? METRIC_ADD : METRIC_SUB, 0, 0);
+    }
+}
+
+int
+metric_compile(metric_t *m, const char *def, ctr_list_t *t_ctrs,
+               ctr_list_t *p_ctrs, char *err, size_t err_len)
+{
+    const char *eq = strchr(def, '=');
+    parser_t p = { m, NULL, t_ctrs, p_ctrs, err, err_len, 0 };
+
+    memset(m, 0, sizeof(*m));
+    if (!eq || eq == def || eq - def >= METRIC_MAX_NAME) {
+        snprintf(err, err_len, "Expected NAME=EXPR");
+        return -1;
+    }
+    for (const char *c = def; c < eq; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') {
+            snprintf(err, err_len, "Invalid metric name");
+            return -1;
+        }
+    }
+
+    memcpy(m->name, def, eq - def);
+    m->expr = eq + 1;
+
+    p.pos = m->expr;
+    parse_expr(&p);
+    skip_space(&p);
+    if (!p.failed && *p.pos)
+        parse_error(&p, "Unexpected '%s'", p.pos);
+
+    return p.failed ? -1 : 0;
+}
+
+double
+metric_eval(const metric_t *m, const uint64_t *ctr, int n_t_ctrs,
+            int n_pirates, int n_p_ctrs)
+{
+    double stack[METRIC_MAX_CODE];
+    int sp = 0;
+
+    for (int i = 0; i < m->n_code; i++) {
+        const metric_insn_t *insn = &m->code[i];
+        double sum;
+
+        switch (insn->op) {
+        case METRIC_CONST:
+            stack[sp++] = insn->val;
+            break;
+
+        case METRIC_TARGET:
+            stack[sp++] = ctr[insn->idx];
+            break;
+
+        case METRIC_PIRATE:
+            sum = 0;
+            for (int j = 0; j < n_pirates; j++)
+                sum += ctr[n_t_ctrs + j * n_p_ctrs + insn->idx];
+            stack[sp++] = sum;
+            break;
+
+        case METRIC_ADD:
+            sp--;
+            stack[sp - 1] += stack[sp];
+            break;
+
+        case METRIC_SUB:
+            sp--;
+            stack[sp - 1] -= stack[sp];
+            break;
+
+        case METRIC_MUL:
+            sp--;
+            stack[sp - 1] *= stack[sp];
+            break;
+
+        case METRIC_DIV:
+            sp--;
+            stack[sp - 1] = stack[sp] != 0 ? stack[sp - 1] / stack[sp] : NAN;
+            break;
+
+        case METRIC_NEG:
+            stack[sp - 1] = -stack[sp - 1];
+            break;
+        }
+    }
+
+    return sp == 1 ? stack[0] : NAN;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
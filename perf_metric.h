@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Derived metrics, --metric NAME=EXPR.
+ *
+ * An expression combines counters with + - * /, parentheses and
+ * numbers. A counter is named as it was given to -e, -r or -E: a bare
+ * name is a target counter, and pirate.NAME is the sum of a counter
+ * over all pirate threads. Names may contain '-', so a subtraction
+ * needs spaces around its '-'. For example:
+ *
+ *   cpi=PERF_COUNT_HW_CPU_CYCLES/PERF_COUNT_HW_INSTRUCTIONS
+ *   p_cpi=pirate.PERF_COUNT_HW_CPU_CYCLES/pirate.PERF_COUNT_HW_INSTRUCTIONS
+ *
+ * Expressions are compiled once into stack code that refers to the
+ * counters by their position in a sample, see metric_eval().
+ */
+
+#ifndef PERF_METRIC_H
+#define PERF_METRIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "perf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRIC_MAX_NAME 64
+#define METRIC_MAX_CODE 64
+
+typedef enum {
+    METRIC_CONST,
+    /* Push a target counter */
+    METRIC_TARGET,
+    /* Push the sum of a pirate counter over all pirates */
+    METRIC_PIRATE,
+    METRIC_ADD,
+    METRIC_SUB,
+    METRIC_MUL,
+    METRIC_DIV,
+    METRIC_NEG,
+} metric_op_t;
+
+typedef struct {
+    metric_op_t op;
+    /* Counter index, METRIC_TARGET and METRIC_PIRATE */
+    int idx;
+    /* METRIC_CONST */
+    double val;
+} metric_insn_t;
+
+typedef struct {
+    char name[METRIC_MAX_NAME];
+    const char *expr;
+    metric_insn_t code[METRIC_MAX_CODE];
+    int n_code;
+} metric_t;
+
+/**
+ * Compile a metric definition.
+ *
+ * @param m Metric to compile into
+ * @param def Definition, NAME=EXPR. Must stay valid as long as m.
+ * @param t_ctrs Target counters
+ * @param p_ctrs Counters of a pirate thread
+ * @param err Buffer for an error message
+ * @param err_len Size of err
+ *
+ * @return 0 on success, -1 on error.
+ */
+int metric_compile(metric_t *m, const char *def, ctr_list_t *t_ctrs,
+                   ctr_list_t *p_ctrs, char *err, size_t err_len);
+
+/**
+ * Evaluate a metric. Division by zero gives NaN.
+ *
+ * @param ctr Target counter values followed by the counter values of
+ *            each pirate, as stored in a sample
+ */
+double metric_eval(const metric_t *m, const uint64_t *ctr, int n_t_ctrs,
+                   int n_pirates, int n_p_ctrs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <ostream>
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+#include <string.h>
+
+#include "expect.h"
+#include "perf_pbdump.h"
+#include "perf_pb.pb.h"
+
+static int n_t_ctrs = 0;
+static int n_pirates = 0;
+static int n_p_ctrs = 0;
+static int n_bandits = 0;
+static int n_b_ctrs = 0;
+static int n_metrics = 0;
+static bool t_groups = false;
+
+static PerfCtrDump dump;
+static vector<uint8_t> buf(PBD_BUF_SIZE);
+static size_t buf_used = 0;
+
+void
+pbd_initialize(int _n_t_ctrs, int _n_pirates, int _n_p_ctrs,
+	       int _n_bandits, int _n_b_ctrs, int _n_metrics, bool groups)
+{
+	n_t_ctrs = _n_t_ctrs;
+	n_pirates = _n_pirates;
+	n_p_ctrs = _n_p_ctrs;
+	n_bandits = _n_bandits;
+	n_b_ctrs = _n_b_ctrs;
+	n_metrics = _n_metrics;
+	t_groups = groups;
+}
+
+void
+pbd_flush(ostream &out)
+{
+	if (!buf_used)
+		return;
+	out.write((const char *)&buf[0], buf_used);
+	buf_used = 0;
+}
+
+void
+pbd_write_sample(ostream &out, const sample_info_t *info, const uint64_t *ctr,
+		 const double *metric)
+{
+	/* Clear() keeps the repeated fields and submessages allocated */
+	dump.Clear();
+
+	PerfCtrSample *t_samp = dump.mutable_t_sample();
+
+	dump.set_schedule((Schedule)info->schedule);
+	if (info->heat_time)
+		dump.set_heat_time(info->heat_time);
+	if (info->phase)
+		dump.set_phase((Phase)info->phase);
+	if (t_groups)
+		dump.set_group(info->group);
+	if (info->time) {
+		dump.set_time(info->time);
+		dump.set_size_time(info->size_time);
+	}
+
+	t_samp->set_size(info->t_size);
+	for (int i = 0; i < n_t_ctrs; i++)
+		t_samp->add_ctr(*ctr++);
+
+	for (int j = 0; j < n_pirates; j++) {
+		PerfCtrSample *p_samp = dump.add_p_sample();
+		p_samp->set_size(info->p_size);
+		for (int i = 0; i < n_p_ctrs; i++)
+			p_samp->add_ctr(*ctr++);
+	}
+
+	if (info->pirate_delay)
+		dump.set_pirate_delay(info->pirate_delay);
+	if (n_bandits)
+		dump.set_bandit_rate(info->bandit_rate);
+	for (int j = 0; j < n_bandits; j++) {
+		PerfCtrSample *b_samp = dump.add_b_sample();
+		for (int i = 0; i <= n_b_ctrs; i++)
+			b_samp->add_ctr(*ctr++);
+	}
+
+	for (int i = 0; i < n_metrics; i++)
+		dump.add_metric(metric[i]);
+
+	/* Caches the size of every submessage for the serialization */
+	const uint32_t size = dump.ByteSizeLong();
+	const size_t len = sizeof(size) + size;
+
+	if (buf.size() - buf_used < len) {
+		pbd_flush(out);
+		if (buf.size() < len)
+			buf.resize(len);
+	}
+
+	memcpy(&buf[buf_used], &size, sizeof(size));
+	uint8_t *end = dump.SerializeWithCachedSizesToArray(
+		&buf[buf_used + sizeof(size)]);
+	EXPECT(end == &buf[buf_used + len]);
+	buf_used += len;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
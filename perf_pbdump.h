@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Serializer for the samples of PIRATEv1 output.
+ *
+ * One PerfCtrDump is reused for all samples, so its repeated fields
+ * and pirate submessages keep their memory, and the size of each
+ * message is only computed once. The length prefixed messages are
+ * serialized into a large buffer that is written to the output when
+ * it fills up. The output is byte for byte the same as serializing a
+ * new message per sample.
+ */
+
+#ifndef PERF_PBDUMP_H
+#define PERF_PBDUMP_H
+
+#include <ostream>
+#include <stdint.h>
+
+#include "perfpirate.h"
+
+#define PBD_BUF_SIZE (1 << 20)
+
+/**
+ * Set up the serializer.
+ *
+ * @param n_t_ctrs Number of target counters
+ * @param n_pirates Number of pirate threads
+ * @param n_p_ctrs Number of counters on each pirate
+ * @param n_bandits Number of bandwidth bandits
+ * @param n_b_ctrs Number of counters on each bandit
+ * @param n_metrics Number of derived metrics
+ * @param groups Target counters are multiplexed, store the group
+ */
+void pbd_initialize(int n_t_ctrs, int n_pirates, int n_p_ctrs,
+                    int n_bandits, int n_b_ctrs, int n_metrics, bool groups);
+
+/**
+ * Add a sample, the buffer is written to out when it fills up.
+ *
+ * @param info Sample sizes and cycle
+ * @param ctr Target counter values followed by the counter values of
+ *            each pirate and the counter values and bytes written of
+ *            each bandit
+ * @param metric Value of each metric
+ */
+void pbd_write_sample(std::ostream &out, const sample_info_t *info,
+                      const uint64_t *ctr, const double *metric);
+
+/**
+ * Write the buffered samples to out.
+ */
+void pbd_flush(std::ostream &out);
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
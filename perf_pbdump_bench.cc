@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark of the PIRATEv1 sample serializer. Compares
+ * perf_pbdump.cc with building a new message per sample and
+ * serializing it through the ostream, checks that both write the
+ * same bytes, and reports samples per second for each.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "expect.h"
+#include "perfpirate.h"
+#include "perf_pbdump.h"
+#include "perf_pb.pb.h"
+
+#define BENCH_T_CTRS 4
+#define BENCH_PIRATES 2
+#define BENCH_P_CTRS 2
+#define BENCH_METRICS 1
+#define BENCH_N_CTRS (BENCH_T_CTRS + BENCH_PIRATES * BENCH_P_CTRS)
+#define BENCH_DEFAULT_SAMPLES 4000000
+#define BENCH_CHECK_SAMPLES 100000
+
+typedef struct {
+	sample_info_t info;
+	uint64_t ctr[BENCH_N_CTRS];
+	double metric[BENCH_METRICS];
+} bench_sample_t;
+
+static double
+now()
+{
+	struct timespec ts;
+
+	EXPECT(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+/* Serialization as done before perf_pbdump.cc */
+static void
+write_new_message(ostream &out, const bench_sample_t *s)
+{
+	PerfCtrDump dump;
+	const uint64_t *ctr = s->ctr;
+
+	PerfCtrSample *t_samp = dump.mutable_t_sample();
+
+	dump.set_schedule((Schedule)s->info.schedule);
+	if (s->info.time) {
+		dump.set_time(s->info.time);
+		dump.set_size_time(s->info.size_time);
+	}
+
+	t_samp->set_size(s->info.t_size);
+	for (int i = 0; i < BENCH_T_CTRS; i++)
+		t_samp->add_ctr(*ctr++);
+
+	for (int j = 0; j < BENCH_PIRATES; j++) {
+		PerfCtrSample *p_samp = dump.add_p_sample();
+		p_samp->set_size(s->info.p_size);
+		for (int i = 0; i < BENCH_P_CTRS; i++)
+			p_samp->add_ctr(*ctr++);
+	}
+
+	for (int i = 0; i < BENCH_METRICS; i++)
+		dump.add_metric(s->metric[i]);
+
+	uint32_t size = dump.ByteSizeLong();
+	out.write((char *)&size, sizeof(size));
+	dump.SerializeToOstream(&out);
+}
+
+static void
+write_pbdump(ostream &out, const bench_sample_t *s)
+{
+	pbd_write_sample(out, &s->info, s->ctr, s->metric);
+}
+
+static double
+run(ostream &out, void (*write)(ostream &, const bench_sample_t *),
+    const vector<bench_sample_t> &samples, long n)
+{
+	const double start = now();
+
+	for (long i = 0; i < n; i++)
+		write(out, &samples[i % samples.size()]);
+	pbd_flush(out);
+	out.flush();
+
+	return now() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+	const long n = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_SAMPLES;
+	vector<bench_sample_t> samples(4096);
+	unsigned seed = 1;
+
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+	if (argc > 2 || n < 1) {
+		fprintf(stderr, "Usage: %s [SAMPLES]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < samples.size(); i++) {
+		bench_sample_t *s = &samples[i];
+
+		memset(&s->info, 0, sizeof(s->info));
+		s->info.t_size = (i % 64) << 16;
+		s->info.p_size = (64 - i % 64) << 16;
+		s->info.time = i * 25000000ULL;
+		s->info.size_time = s->info.time;
+		s->ctr[0] = 100000000 + rand_r(&seed) % 1000;
+		for (int c = 1; c < BENCH_N_CTRS; c++)
+			s->ctr[c] = rand_r(&seed);
+		s->metric[0] = (double)s->ctr[1] / s->ctr[0];
+	}
+
+	pbd_initialize(BENCH_T_CTRS, BENCH_PIRATES, BENCH_P_CTRS, 0, 0,
+		       BENCH_METRICS, false);
+
+	ostringstream ref, out;
+	run(ref, &write_new_message, samples, BENCH_CHECK_SAMPLES);
+	run(out, &write_pbdump, samples, BENCH_CHECK_SAMPLES);
+	if (ref.str() != out.str()) {
+		fprintf(stderr, "Output differs from a new message per sample\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("Output identical for %i samples, %zu bytes\n",
+	       BENCH_CHECK_SAMPLES, out.str().size());
+
+	ofstream null("/dev/null", ios::out | ios::binary);
+	EXPECT(null.good());
+
+	const double t_ref = run(null, &write_new_message, samples, n);
+	printf("New message per sample: %.2f M samples/s\n", n / t_ref / 1E6);
+	const double t_pbd = run(null, &write_pbdump, samples, n);
+	printf("Reused message, buffered: %.2f M samples/s (%.2fx)\n",
+	       n / t_pbd / 1E6, t_ref / t_pbd);
+
+	return 0;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
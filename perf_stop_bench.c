@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark of the counter work perfpirate does between stopping
+ * and continuing the target. Opens a target group and a group per
+ * Pirate on this thread and, for every sample, reads all groups and
+ * resets them, either as before read_counter_group() (a malloc'ed and
+ * cleared buffer per group and one reset ioctl per counter) or as now
+ * (preallocated buffers and one group reset ioctl per group). Reports
+ * the latency of both.
+ */
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "expect.h"
+
+#define BENCH_T_CTRS 4
+#define BENCH_PIRATES 2
+#define BENCH_P_CTRS 2
+#define BENCH_GROUPS (1 + BENCH_PIRATES)
+#define BENCH_MAX_CTRS BENCH_T_CTRS
+#define BENCH_DEFAULT_SAMPLES 200000
+
+/* The layout of a group read, as in perfpirate.h */
+typedef struct {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    struct ctr_data {
+        uint64_t val;
+    } ctr[];
+} read_format_t;
+
+typedef struct {
+    int fd[BENCH_MAX_CTRS];
+    int len;
+    read_format_t *data;
+} bench_group_t;
+
+static bench_group_t groups[BENCH_GROUPS];
+
+static const uint64_t hw_events[] = {
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_CACHE_REFERENCES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static const uint64_t sw_events[] = {
+    PERF_COUNT_SW_TASK_CLOCK,
+    PERF_COUNT_SW_PAGE_FAULTS,
+    PERF_COUNT_SW_CONTEXT_SWITCHES,
+    PERF_COUNT_SW_CPU_MIGRATIONS,
+};
+
+static uint64_t
+now()
+{
+    struct timespec ts;
+
+    EXPECT(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+open_ctr(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP |
+        PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static int
+open_groups(uint32_t type, const uint64_t *events)
+{
+    for (int g = 0; g < BENCH_GROUPS; g++) {
+        bench_group_t *group = &groups[g];
+
+        group->len = g ? BENCH_P_CTRS : BENCH_T_CTRS;
+        for (int i = 0; i < group->len; i++) {
+            group->fd[i] = open_ctr(type, events[i],
+                                    i ? group->fd[0] : -1);
+            if (group->fd[i] == -1) {
+                while (i--)
+                    close(group->fd[i]);
+                while (g--)
+                    for (int j = 0; j < groups[g].len; j++)
+                        close(groups[g].fd[j]);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static size_t
+group_size(const bench_group_t *group)
+{
+    return sizeof(read_format_t) + sizeof(struct ctr_data) * group->len;
+}
+
+static void
+read_group(const bench_group_t *group, read_format_t *data)
+{
+    EXPECT_ERRNO(read(group->fd[0], data, group_size(group)) ==
+                 (ssize_t)group_size(group));
+}
+
+/* dump_all_events() and reset_all_events() before the preallocated
+ * buffers and group resets */
+static void
+sample_old()
+{
+    read_format_t *data[BENCH_GROUPS];
+
+    for (int g = 0; g < BENCH_GROUPS; g++) {
+        data[g] = (read_format_t *)malloc(group_size(&groups[g]));
+        memset(data[g], '\0', group_size(&groups[g]));
+        read_group(&groups[g], data[g]);
+    }
+    for (int g = 0; g < BENCH_GROUPS; g++)
+        free(data[g]);
+
+    for (int g = 0; g < BENCH_GROUPS; g++)
+        for (int i = 0; i < groups[g].len; i++)
+            EXPECT_ERRNO(-1 != ioctl(groups[g].fd[i],
+                                     PERF_EVENT_IOC_RESET, 0));
+}
+
+static void
+sample_new()
+{
+    for (int g = 0; g < BENCH_GROUPS; g++)
+        read_group(&groups[g], groups[g].data);
+
+    for (int g = 0; g < BENCH_GROUPS; g++)
+        EXPECT_ERRNO(-1 != ioctl(groups[g].fd[0], PERF_EVENT_IOC_RESET,
+                                 PERF_IOC_FLAG_GROUP));
+}
+
+static void
+run(const char *name, void (*sample)(), long n)
+{
+    uint64_t min = UINT64_MAX, max = 0, sum = 0;
+
+    for (long i = 0; i < n; i++) {
+        const uint64_t start = now();
+        uint64_t ns;
+
+        sample();
+        ns = now() - start;
+        sum += ns;
+        if (ns < min)
+            min = ns;
+        if (ns > max)
+            max = ns;
+    }
+
+    printf("%s: min %" PRIu64 " ns, mean %.0f ns, max %" PRIu64 " ns\n",
+           name, min, (double)sum / n, max);
+}
+
+int
+main(int argc, char **argv)
+{
+    const long n = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_SAMPLES;
+
+    if (argc > 2 || n < 1) {
+        fprintf(stderr, "Usage: %s [SAMPLES]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (open_groups(PERF_TYPE_HARDWARE, hw_events)) {
+        printf("Hardware counters, ");
+    } else if (open_groups(PERF_TYPE_SOFTWARE, sw_events)) {
+        printf("No hardware counters, using software events, ");
+    } else {
+        perror("Failed to open the counter groups");
+        exit(EXIT_FAILURE);
+    }
+    printf("%i groups of %i and %i counters, %li samples\n",
+           BENCH_GROUPS, BENCH_T_CTRS, BENCH_P_CTRS, n);
+
+    for (int g = 0; g < BENCH_GROUPS; g++)
+        EXPECT(groups[g].data = (read_format_t *)malloc(
+                   group_size(&groups[g])));
+
+    for (long i = 0; i < n / 10; i++)
+        sample_new();
+    run("malloc, per-counter reset", &sample_old, n);
+    run("Preallocated, group reset", &sample_new, n);
+
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
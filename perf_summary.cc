@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <fstream>
+#include <vector>
+#include <map>
+#include <string>
+using namespace std;
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "expect.h"
+#include "perf_common.h"
+#include "perf_summary.h"
+#include "perf_pb.pb.h"
+
+typedef struct {
+	uint64_t sum;
+	double mean;
+	/* Sum of squared differences from the mean */
+	double m2;
+	uint64_t min;
+	uint64_t max;
+} sum_stat_t;
+
+typedef struct {
+	uint32_t p_size;
+	/* Pirate delay of the last sample, see --governor */
+	uint32_t p_delay;
+	uint64_t count;
+	/* Target counters followed by the counters of each pirate and
+	 * the counters and bytes of each bandit */
+	vector<sum_stat_t> stat;
+} sum_entry_t;
+
+/* Target size and bandit rate, counter group and phase */
+typedef pair<pair<uint32_t, uint32_t>, pair<uint32_t, uint32_t> > sum_key_t;
+
+static string sum_file;
+static PerfHeader sum_header;
+static int n_t_ctrs, n_pirates, n_p_ctrs, n_bandits, n_b_ctrs;
+static const metric_t *metrics;
+static int n_metrics;
+static uint64_t interval_ns = 0;
+static uint64_t next_write = 0;
+static uint64_t n_samples = 0;
+static map<sum_key_t, sum_entry_t> entries;
+
+void
+sum_initialize(const char *file, int _n_t_ctrs, int _n_pirates,
+	       int _n_p_ctrs, int _n_bandits, int _n_b_ctrs,
+	       const metric_t *_metrics, int _n_metrics, int interval_sec)
+{
+	sum_file = file;
+	n_t_ctrs = _n_t_ctrs;
+	n_pirates = _n_pirates;
+	n_p_ctrs = _n_p_ctrs;
+	n_bandits = _n_bandits;
+	n_b_ctrs = _n_b_ctrs;
+	metrics = _metrics;
+	n_metrics = _n_metrics;
+	interval_ns = interval_sec * 1000000000ULL;
+	next_write = lat_now() + interval_ns;
+}
+
+void
+sum_set_header(const PerfHeader &header)
+{
+	sum_header = header;
+}
+
+static void
+sum_fill(PerfSummary::Stats *pb, const sum_entry_t &entry, int first, int n)
+{
+	for (int i = first; i < first + n; i++) {
+		const sum_stat_t &s = entry.stat[i];
+
+		pb->add_sum(s.sum);
+		pb->add_mean(s.mean);
+		pb->add_variance(entry.count > 1 ? s.m2 / (entry.count - 1) : 0);
+		pb->add_min(s.min);
+		pb->add_max(s.max);
+	}
+}
+
+static void
+sum_write(bool final)
+{
+	const string tmp = sum_file + ".tmp";
+	fstream out(tmp.c_str(), ios::out | ios::trunc | ios::binary);
+	PerfSummary summary;
+	vector<uint64_t> sums;
+	uint32_t size;
+
+	summary.set_samples(n_samples);
+	summary.set_final(final);
+	for (map<sum_key_t, sum_entry_t>::const_iterator it = entries.begin();
+	     it != entries.end(); ++it) {
+		const sum_entry_t &entry = it->second;
+		PerfSummary::Size *pb = summary.add_size();
+
+		pb->set_size(it->first.first.first);
+		pb->set_p_size(entry.p_size);
+		pb->set_group(it->first.second.first);
+		pb->set_phase((Phase)it->first.second.second);
+		pb->set_count(entry.count);
+		if (entry.p_delay)
+			pb->set_pirate_delay(entry.p_delay);
+		sum_fill(pb->mutable_target(), entry, 0, n_t_ctrs);
+		for (int j = 0; j < n_pirates; j++)
+			sum_fill(pb->add_pirate(), entry,
+				 n_t_ctrs + j * n_p_ctrs, n_p_ctrs);
+		if (n_bandits)
+			pb->set_bandit_rate(it->first.first.second);
+		for (int j = 0; j < n_bandits; j++)
+			sum_fill(pb->add_bandit(), entry,
+				 n_t_ctrs + n_pirates * n_p_ctrs +
+				 j * (n_b_ctrs + 1), n_b_ctrs + 1);
+
+		/* Ratios of the sums, not the mean of the sample ratios */
+		sums.clear();
+		for (size_t i = 0; i < entry.stat.size(); i++)
+			sums.push_back(entry.stat[i].sum);
+		for (int i = 0; i < n_metrics; i++)
+			pb->add_metric(metric_eval(&metrics[i], &sums[0], n_t_ctrs,
+						   n_pirates, n_p_ctrs));
+	}
+
+	EXPECT(out);
+	out << SUM_MAGIC;
+	size = sum_header.ByteSizeLong();
+	out.write((char *)&size, sizeof(size));
+	EXPECT(sum_header.SerializeToOstream(&out));
+	size = summary.ByteSizeLong();
+	out.write((char *)&size, sizeof(size));
+	EXPECT(summary.SerializeToOstream(&out));
+	EXPECT(out.flush());
+	out.close();
+
+	EXPECT_ERRNO(rename(tmp.c_str(), sum_file.c_str()) == 0);
+}
+
+void
+sum_add_sample(const sample_info_t *info, const uint64_t *ctr)
+{
+	const int n_ctrs = n_t_ctrs + n_pirates * n_p_ctrs +
+		n_bandits * (n_b_ctrs + 1);
+	const sum_key_t key(make_pair(info->t_size, info->bandit_rate),
+			    make_pair(info->group, info->phase));
+	sum_entry_t &entry = entries[key];
+
+	if (!entry.count) {
+		sum_stat_t init = { 0, 0, 0, UINT64_MAX, 0 };
+
+		entry.p_size = info->p_size;
+		entry.stat.assign(n_ctrs, init);
+	}
+	entry.p_delay = info->pirate_delay;
+	entry.count++;
+	n_samples++;
+
+	for (int i = 0; i < n_ctrs; i++) {
+		sum_stat_t &s = entry.stat[i];
+		const double delta = ctr[i] - s.mean;
+
+		s.sum += ctr[i];
+		s.mean += delta / entry.count;
+		s.m2 += delta * (ctr[i] - s.mean);
+		if (ctr[i] < s.min)
+			s.min = ctr[i];
+		if (ctr[i] > s.max)
+			s.max = ctr[i];
+	}
+
+	if (interval_ns && lat_now() >= next_write) {
+		sum_write(false);
+		next_write = lat_now() + interval_ns;
+	}
+}
+
+void
+sum_finalize()
+{
+	sum_write(true);
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Per-size summary output, --summary.
+ *
+ * The writer thread keeps the count, sum, mean, variance (Welford),
+ * minimum and maximum of every counter for each target size, bandit
+ * rate, counter group and --discard phase. File layout:
+ *
+ *   "PIRATEs1"
+ *   uint32_t length, PerfHeader      Same as PIRATEv1
+ *   uint32_t length, PerfSummary
+ *
+ * The file is rewritten periodically while perfpirate runs, through a
+ * temporary file that is renamed over it, so readers always see a
+ * complete summary.
+ */
+
+#ifndef PERF_SUMMARY_H
+#define PERF_SUMMARY_H
+
+#include <stdint.h>
+
+#include "perf_metric.h"
+#include "perfpirate.h"
+
+class PerfHeader;
+
+#define SUM_MAGIC "PIRATEs1"
+
+/**
+ * Set up the statistics.
+ *
+ * @param file Summary file name
+ * @param n_t_ctrs Number of target counters
+ * @param n_pirates Number of pirate threads
+ * @param n_p_ctrs Number of counters on each pirate
+ * @param n_bandits Number of bandwidth bandits
+ * @param n_b_ctrs Number of counters on each bandit
+ * @param metrics Derived metrics, evaluated on the sums of each size
+ * @param n_metrics Number of metrics
+ * @param interval_sec Seconds between summary writes, 0 to only write
+ *                     the summary at exit
+ */
+void sum_initialize(const char *file, int n_t_ctrs, int n_pirates,
+                    int n_p_ctrs, int n_bandits, int n_b_ctrs,
+                    const metric_t *metrics, int n_metrics,
+                    int interval_sec);
+
+/**
+ * Keep a copy of the header for the summary file. Must be called
+ * before the first sample is added.
+ */
+void sum_set_header(const PerfHeader &header);
+
+/**
+ * Add a sample, and write the summary if the interval has passed.
+ *
+ * @param info Sample sizes, bandit rate, group and phase
+ * @param ctr Target counter values followed by the counter values of
+ *            each pirate and the counter values and bytes written of
+ *            each bandit
+ */
+void sum_add_sample(const sample_info_t *info, const uint64_t *ctr);
+
+/**
+ * Write the final summary.
+ */
+void sum_finalize();
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -53,10 +53,15 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <math.h>
 #include <pthread.h>
 
 #include <argp.h>
 #include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include <sys/types.h>
 
 
@@ -64,6 +69,13 @@
 #include "perfpirate.h"
 #include "perf_common.h"
 #include "perf_data.h"
+#include "perf_metric.h"
+#include "pirate_kernels.h"
+#include "topology.h"
+#include "sweep.h"
+#include "schedule.h"
+#include "slice.h"
+#include "governor.h"
 
 
 /* Configuration options */
@@ -75,17 +87,105 @@ static int target_cpu = 0;
 static pid_t target_pid = NO_PID;
 static volatile target_state_t target_state = TARGET_WAIT_EXEC;
 static int target_ctrs_len = 0;
+/* Counters in the active target group, including the --discard
+ * trigger */
+static int target_group_len = 0;
+
+typedef struct {
+    uint64_t enabled;
+    uint64_t running;
+} ctr_times_t;
+
+/*
+ * --group-size: Target events that don't fit in one group are split
+ * into groups that take turns, one sweep cycle each. Every group has
+ * its own copy of the sampling instruction leader.
+ */
+typedef struct {
+    ctr_list_t ctrs;
+    int len;
+    /* Index of every counter in perf_ctrs */
+    int *idx;
+    /* Times at the start of the period */
+    ctr_times_t times;
+} ctr_group_t;
+
+static int group_size = 0;
+static ctr_group_t *ctr_groups = NULL;
+static int n_ctr_groups = 0;
+static int cur_group = 0;
+/* Active target group, perf_ctrs unless the events are multiplexed */
+static ctr_list_t *target_ctrs = &perf_ctrs;
+static ctr_times_t target_times;
+static read_format_t *group_data;
 static long t_heat_usek = 10000; /* Default value for target heating */
 
 
 static int n_pirates = 0;
-static int pirate_cpus[MAX_PIRATES];
+static int *pirate_cpus = NULL;
 static char *extra_p_ctrs[MAX_EXTRA_P_CTRS];
 static int no_extra_p_ctrs=0;
-static volatile pirate_state_t *pirate_state;
 static ctr_list_t *pirate_ctrs;
 static int pirate_ctrs_len = 0;
 
+/* --huge-pages, and the memory of the data set */
+static mem_pages_t huge_pages = MEM_PAGES_AUTO;
+static mem_huge_t pirate_mem;
+/* The color kernel found the physical addresses of the data set */
+static int color_physical = 0;
+/* --slices, the LLC miss counter of the eviction tests, and what the
+ * calibration found, see slice_occupancy() */
+static int n_slices = 0;
+static ctr_list_t slice_ctrs;
+static int slice_tested_sets = 0;
+static uint32_t *slice_occ = NULL;
+static int slice_occ_len = 0;
+
+/*
+ * Bandwidth bandits, -C CPU:bandit. Every bandit streams through its
+ * own buffer, far larger than the LLC, with non-temporal stores at
+ * the rate in bandit_sync. The rates of --bandit-rates take turns,
+ * one sweep cycle each, like the multiplexed target groups.
+ */
+static int n_bandits = 0;
+static int *bandit_cpus = NULL;
+static char *bandit_events[MAX_EXTRA_P_CTRS];
+static int n_bandit_events = 0;
+static ctr_list_t *bandit_ctrs;
+static int bandit_ctrs_len = 0;
+static uint64_t bandit_size = 0;
+static uint32_t *bandit_rates = NULL;
+static int n_bandit_rates = 0;
+static int bandit_level = 0;
+
+/* Per bandit state, one cache line each */
+typedef struct {
+    /* Bytes written so far, by the bandit */
+    volatile uint64_t bytes;
+    /* bytes at the last reset, by the sampler */
+    uint64_t base;
+    mem_huge_t mem;
+    int cpu;
+    int bandit_number;
+} __attribute__((aligned(CACHE_LINE_SIZE))) bandit_slot_t;
+
+static bandit_slot_t *bandit_slot;
+static pthread_t *bandit_thread;
+static struct {
+    /* Current rate in MB/s, written by the sampler */
+    futex_word_t rate __attribute__((aligned(CACHE_LINE_SIZE)));
+} bandit_sync;
+
+/* --governor: fetch ratio threshold, 0 if off, the pirate counters it
+ * follows, the calibration of pirate_delay() and the delay in ns the
+ * pirates run at */
+static double gov_threshold = 0;
+static gov_t governor;
+static int gov_access_idx = 0;
+static int gov_miss_idx = 0;
+static double delay_loops_per_ns = 0;
+static uint32_t gov_delay_ns = 0;
+
 static pthread_t *pirate_thread;
 static pirate_pthread_conf_t *pirate_pthread_conf;
 static pirate_conf_t pirate_conf = {
@@ -93,41 +193,195 @@ static pirate_conf_t pirate_conf = {
     .current_size = 0,
     .no_sweep = 0,
     .no_reference = 0,
+    .kernel = PIRATE_KERNEL_STRIDE,
+    .streams = MLP_DEFAULT_STREAMS,
 };
 static pthread_barrier_t pirate_barrier;
 
+/* Preallocated counter read buffers, [0] is the target, [i+1]
+ * pirate i and [n_pirates+i+1] bandit i, whose counters are followed
+ * by the bytes it wrote. All of them live in the contiguous
+ * sample_buf. */
+static read_format_t **sample_data;
+static void *sample_buf;
+
+static int print_stats = 0;
+static int writer_slots = DEFAULT_WRITER_SLOTS;
+static int writer_drop = 0;
+static output_format_t output_format = OUTPUT_PROTOBUF;
+static const char *summary_name = NULL;
+static int summary_interval = SUMMARY_DEFAULT_INTERVAL_SEC;
+static int raw_output = 1;
+/* --metric definitions, compiled once the counters are set up */
+static const char **metric_defs = NULL;
+static metric_t *metrics = NULL;
+static int n_metrics = 0;
+static uint32_t sweep_cycle = 0;
+
+static int pirate_rdpmc = 0;
+static int *pirate_use_rdpmc;
+static pirate_snap_t **pirate_snap;
+/* Snapshot values at the last reset, pirate_ctrs_len per pirate */
+static uint64_t *pirate_base;
+
+static int stop_free = 0;
+static perf_ring_t target_ring;
+static read_format_t *ring_prev;
+static uint64_t size_time = 0;
+static uint64_t heat_end = 0;
+static int heating = 0;
+static uint64_t ring_lost = 0;
+static lat_stat_t stop_lat;
+static uint64_t stop_begin = 0;
+
+/* --domains: Number of LLC domains (-1 for all) and the CPUs and
+ * target CPU of each. domain is the domain of this process. */
+static int n_domains = 1;
+static int domain = 0;
+static cpu_set_t *domain_cpus;
+static int *domain_target;
+
+static schedule_id_t schedule_id = SCHEDULE_ASCENDING;
+static schedule_t schedule;
+static uint32_t *schedule_list = NULL;
+static int schedule_list_len = 0;
+static uint64_t schedule_seed = 1;
+static double ci_width = SWEEP_DEFAULT_CI_WIDTH;
+/* Heat the target when the pirate shrinks by this many ways or more,
+ * 0 for half of the ways */
+static int heat_drop_ways = 0;
+static int heat_drop = 0;
+
+/* --heat-converge: Heat until the target metric is stable */
+static int heat_converge = 0;
+static long heat_window_usec = HEAT_DEFAULT_WINDOW_USEC;
+static long heat_max_usec = HEAT_DEFAULT_MAX_USEC;
+static read_format_t *heat_data[2];
+/* Duration of the last heating, stored in the next sample */
+static uint64_t heat_time = 0;
+static lat_stat_t heat_lat;
+
+typedef struct {
+    uint64_t begin;
+    double last;
+    int stable;
+} heat_state_t;
+
+static heat_state_t heat;
+
+/*
+ * --discard: A one-shot instruction counter in the target group
+ * overflows DISCARD instructions after a size change and records the
+ * group in its sample buffer. The period is then dumped as a
+ * discarded prefix and a measured remainder, without stopping the
+ * target at the split.
+ */
+static uint64_t discard_insns = 0;
+static ctr_list_t discard_ctrs = { NULL, NULL };
+static perf_ring_t discard_ring;
+static int discard_armed = 0;
+/* The trigger didn't fire in the last period, so it still has the
+ * event limit of its last refresh */
+static int discard_limit_left = 0;
+static uint64_t discard_time;
+/* Group at the start of the period, and at the trigger */
+static read_format_t *discard_base;
+static read_format_t *discard_snap;
+/* Prefix of the target, the pirates are only split in the remainder */
+static read_format_t **discard_data;
+
+/*
+ * Size changes are a handshake between the sampler and the pirates.
+ * The sampler bumps the epoch, every pirate makes one warm-up pass
+ * at the new size and arrives at a sense-reversing barrier, where the
+ * last pirate to arrive publishes the epoch in done. Epoch 1 is the
+ * initial warm-up. Words written by the sampler and by the pirates
+ * live on separate cache lines.
+ */
+static struct {
+    /* Written by the sampler */
+    futex_word_t epoch __attribute__((aligned(CACHE_LINE_SIZE)));
+    /* Epoch whose pirates wait after their warm-up pass while the
+     * target is heating, 0 if none */
+    futex_word_t hold;
+    uint64_t epoch_time;
+    /* pirate_delay() loops after every line, --governor */
+    volatile uint32_t delay;
+
+    /* Written by the pirates */
+    volatile uint32_t pending __attribute__((aligned(CACHE_LINE_SIZE)));
+    futex_word_t done;
+} pirate_sync;
+
+/* Per pirate state, one cache line each */
+typedef struct {
+    /* The pirate keeps running while the epoch is run_epoch */
+    volatile uint32_t run_epoch;
+    /* Time from an epoch bump until this pirate arrived */
+    lat_stat_t arrive_lat;
+} __attribute__((aligned(CACHE_LINE_SIZE))) pirate_slot_t;
+
+static pirate_slot_t *pirate_slot;
+static lat_stat_t handshake_lat;
+
 
 static void
 finalize(void) {
 
+    if (print_stats) {
+        char name[64];
+
+        lat_stat_print(stderr, "Target stop-to-continue", &stop_lat);
+        lat_stat_print(stderr, "Target heating", &heat_lat);
+        snprintf(name, sizeof(name), "Pirate handshake (%d pirates)",
+                 n_pirates);
+        lat_stat_print(stderr, name, &handshake_lat);
+        for (int i = 0; i < n_pirates; i++) {
+            snprintf(name, sizeof(name), "Pirate %d arrival", i);
+            lat_stat_print(stderr, name, &pirate_slot[i].arrive_lat);
+        }
+        if (gov_threshold) {
+            fprintf(stderr, "Governor (fetch ratio <= %g):\n", gov_threshold);
+            gov_print(stderr, &governor);
+        }
+    }
+    if (ring_lost)
+        fprintf(stderr, "Warning: Lost %" PRIu64 " target samples.\n",
+                ring_lost);
+    pb_finalize(print_stats);
+    perf_ring_close(&target_ring);
+    perf_ring_close(&discard_ring);
+    ctrs_close(&discard_ctrs);
+
     ctrs_close(&perf_ctrs);
+    for (int i = 0; i < n_ctr_groups; i++)
+        ctrs_close(&ctr_groups[i].ctrs);
     for(int i = 0; i<n_pirates; i++)
         ctrs_close(&pirate_ctrs[i]);
+    for (int i = 0; i < n_bandits; i++)
+        ctrs_close(&bandit_ctrs[i]);
     pfm_terminate();
 }
 
-static read_format_t *
-read_counter_list(int fd_in, int n_counters)
+static void
+read_counter_group(int fd_in, read_format_t *data, int n_counters)
 {
     int data_size, ret;
-    read_format_t *data;
 
     data_size = sizeof(read_format_t) + sizeof(struct ctr_data) * n_counters;
 
-    data = (read_format_t *)malloc(data_size);
-    memset(data, '\0', data_size);
-
     EXPECT_ERRNO((ret = read(fd_in, data, data_size)) != -1);
     if (ret == 0) {
         perror("Got EOF while reading counter\n");
         exit(EXIT_FAILURE);
-    } else if (ret != data_size)
+    } else if (ret != data_size) {
         fprintf(stderr,
                 "Warning: Got short read. Expected %i bytes, "
                 "but got %i bytes.\n",
                 data_size, ret);
-
-    return data;
+        /* The buffer is reused, don't pass on the previous read's tail */
+        memset((char *)data + ret, 0, data_size - ret);
+    }
 }
 
 // static void
@@ -149,23 +403,639 @@ read_counter_list(int fd_in, int n_counters)
 //     fprintf(file_out, "\n");
 // }
 
+/* Delay loops of a delay in ns */
+static uint32_t
+delay_loops(uint32_t ns)
+{
+    return (uint32_t)lrint(ns * delay_loops_per_ns);
+}
+
+/* Run the pirates at the governor's delay for the current size */
+static void
+governor_apply()
+{
+    if (!gov_threshold)
+        return;
+
+    gov_delay_ns = gov_delay(&governor, pirate_conf.current_size);
+    pirate_sync.delay = delay_loops(gov_delay_ns);
+}
+
+/* Let the governor see the pirate counters of a sample */
+static void
+governor_sample()
+{
+    uint64_t accesses = 0, misses = 0;
+
+    if (!gov_threshold)
+        return;
+
+    for (int i = 0; i < n_pirates; i++) {
+        accesses += sample_data[i + 1]->ctr[gov_access_idx].val;
+        misses += sample_data[i + 1]->ctr[gov_miss_idx].val;
+    }
+    gov_add(&governor, pirate_conf.current_size, misses, accesses);
+
+    /* A sweep changes the delay with the size */
+    if (pirate_conf.no_sweep)
+        governor_apply();
+}
+
+static void
+pirates_next_size()
+{
+    const uint32_t epoch = pirate_sync.epoch.val;
+    uint64_t begin;
+
+    /* Wait for the previous handshake, normally long done */
+    futex_word_wait(&pirate_sync.done, epoch - 1);
+
+    governor_apply();
+    begin = lat_now();
+    pirate_sync.epoch_time = print_stats ? begin : 0;
+    __atomic_store_n(&pirate_sync.pending, n_pirates, __ATOMIC_RELAXED);
+    futex_word_store(&pirate_sync.epoch, epoch + 1);
+
+    futex_word_wait(&pirate_sync.done, epoch);
+    if (print_stats)
+        lat_stat_add(&handshake_lat, lat_now() - begin);
+}
+
+static inline int
+pirate_running(const int pirate_number)
+{
+    return pirate_sync.epoch.val == pirate_slot[pirate_number].run_epoch;
+}
+
+static void
+pirate_arrive(const int pirate_number, const uint32_t epoch)
+{
+    const uint64_t epoch_time = pirate_sync.epoch_time;
+
+    if (epoch_time)
+        lat_stat_add(&pirate_slot[pirate_number].arrive_lat,
+                     lat_now() - epoch_time);
+
+    if (__atomic_sub_fetch(&pirate_sync.pending, 1, __ATOMIC_ACQ_REL) == 0)
+        futex_word_store(&pirate_sync.done, epoch);
+}
+
+static void
+reset_events(ctr_list_t *list)
+{
+    /* One ioctl resets the leader and all of its siblings */
+    EXPECT_ERRNO(-1 != ioctl(list->head->fd, 
+                             PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP));
+}
+
+/*
+ * With --pirate-rdpmc the pirate threads read their own counters,
+ * with rdpmc when possible, and publish them after every pass over
+ * their data. The sampler then reads the latest snapshot without any
+ * system calls, and counters are "reset" by remembering the snapshot.
+ */
+static void
+pirate_snap_read(const int pirate_number, uint64_t *val)
+{
+    const pirate_snap_t *snap = pirate_snap[pirate_number];
+
+    while (1) {
+        const uint64_t seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1) {
+            cpu_relax();
+            continue;
+        }
+        memcpy(val, snap->val, sizeof(uint64_t) * pirate_ctrs_len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+}
+
+static void
+read_pirate_ctrs(const int pirate_number)
+{
+    read_format_t *data = sample_data[pirate_number + 1];
+    const uint64_t *base;
+    uint64_t val[pirate_ctrs_len];
+
+    if (!pirate_rdpmc) {
+        read_counter_group(pirate_ctrs[pirate_number].head->fd, data,
+                           pirate_ctrs_len);
+        return;
+    }
+
+    base = &pirate_base[pirate_number * pirate_ctrs_len];
+    pirate_snap_read(pirate_number, val);
+    data->nr = pirate_ctrs_len;
+    data->time_enabled = 0;
+    data->time_running = 0;
+    for (int i = 0; i < pirate_ctrs_len; i++)
+        data->ctr[i].val = val[i] - base[i];
+}
+
+static void
+read_bandit_ctrs(const int bandit_number)
+{
+    read_format_t *data = sample_data[n_pirates + bandit_number + 1];
+    const bandit_slot_t *slot = &bandit_slot[bandit_number];
+
+    read_counter_group(bandit_ctrs[bandit_number].head->fd, data,
+                       bandit_ctrs_len);
+    data->ctr[bandit_ctrs_len].val =
+        __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED) - slot->base;
+}
+
+static void
+reset_bandit_ctrs(const int bandit_number)
+{
+    bandit_slot_t *slot = &bandit_slot[bandit_number];
+
+    reset_events(&bandit_ctrs[bandit_number]);
+    slot->base = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+}
+
+/* Move the bandits to their next rate, at the start of a sweep cycle */
+static void
+rotate_bandit_rate()
+{
+    if (n_bandit_rates < 2)
+        return;
+
+    bandit_level = (bandit_level + 1) % n_bandit_rates;
+    futex_word_store(&bandit_sync.rate, bandit_rates[bandit_level]);
+}
+
+static void
+reset_pirate_ctrs(const int pirate_number)
+{
+    if (pirate_rdpmc)
+        pirate_snap_read(pirate_number,
+                         &pirate_base[pirate_number * pirate_ctrs_len]);
+    else
+        reset_events(&pirate_ctrs[pirate_number]);
+}
+
+/*
+ * Stop-free sampling: The target's counter group writes
+ * PERF_SAMPLE_TIME | PERF_SAMPLE_READ records into a sample buffer
+ * which is drained here while the target keeps running. The record
+ * values are running totals, so samples are the difference to the
+ * previous record. Size changes are stamped with CLOCK_MONOTONIC,
+ * which is also the clock used for the record time stamps.
+ */
+static ctr_times_t *
+cur_times()
+{
+    return n_ctr_groups ? &ctr_groups[cur_group].times : &target_times;
+}
+
+/*
+ * Turn the running times of a group read into the times of the
+ * period since the last read. Returns time_enabled / time_running,
+ * the factor that scales the counts of a group that only ran part of
+ * the period.
+ */
+static double
+period_times(read_format_t *data)
+{
+    ctr_times_t *prev = cur_times();
+    const uint64_t enabled = data->time_enabled;
+    const uint64_t running = data->time_running;
+
+    data->time_enabled = enabled - prev->enabled;
+    data->time_running = running - prev->running;
+    prev->enabled = enabled;
+    prev->running = running;
+
+    return data->time_running ?
+        (double)data->time_enabled / data->time_running : 0;
+}
+
+/*
+ * Read the target counters of a period into sample_data[0]. The
+ * counters of a multiplexed group are scaled, and stored at their
+ * perf_ctrs position with the events of the other groups as 0.
+ */
+static void
+read_target_ctrs()
+{
+    read_format_t *t = sample_data[0];
+    const ctr_group_t *group;
+    double scale;
+
+    if (!n_ctr_groups) {
+        read_counter_group(target_ctrs->head->fd, t, target_group_len);
+        period_times(t);
+        return;
+    }
+
+    group = &ctr_groups[cur_group];
+    read_counter_group(target_ctrs->head->fd, group_data, group->len);
+    scale = period_times(group_data);
+
+    t->nr = target_ctrs_len;
+    t->time_enabled = group_data->time_enabled;
+    t->time_running = group_data->time_running;
+    memset(t->ctr, 0, sizeof(struct ctr_data) * target_ctrs_len);
+    for (int i = 0; i < group->len; i++)
+        t->ctr[group->idx[i]].val = llround(group_data->ctr[i].val * scale);
+}
+
+/* Let the next group count the target, at the start of a sweep cycle */
+static void
+rotate_ctr_groups()
+{
+    int fd;
+
+    if (!n_ctr_groups)
+        return;
+
+    fd = target_ctrs->head->fd;
+    EXPECT_ERRNO(fcntl(fd, F_SETFL, 0) != -1);
+    EXPECT_ERRNO(ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) != -1);
+
+    cur_group = (cur_group + 1) % n_ctr_groups;
+    target_ctrs = &ctr_groups[cur_group].ctrs;
+    target_group_len = ctr_groups[cur_group].len;
+
+    fd = target_ctrs->head->fd;
+    EXPECT_ERRNO(ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) != -1);
+    EXPECT_ERRNO(fcntl(fd, F_SETFL, O_ASYNC) != -1);
+}
+
+/*
+ * The adaptive sweep and convergence heating follow the last target
+ * event per instruction, or the time per instruction if only
+ * instructions are counted.
+ */
+static double
+target_metric(const read_format_t *t)
+{
+    if (!t->ctr[0].val)
+        return 0;
+    /* A multiplexed event is only counted in some of the cycles */
+    if (target_ctrs_len > 1 && !n_ctr_groups)
+        return (double)t->ctr[target_ctrs_len - 1].val / t->ctr[0].val;
+    return (double)t->time_running / t->ctr[0].val;
+}
+
+static void
+heat_start(heat_state_t *h, uint64_t now)
+{
+    h->begin = now;
+    h->last = NAN;
+    h->stable = 0;
+}
+
+/*
+ * Feed the metric of one window to a convergence heating. Returns
+ * true when the metric has been stable for HEAT_STABLE_WINDOWS
+ * windows in a row, or when the heating has run for heat_max_usec.
+ */
+static int
+heat_converged(heat_state_t *h, double metric, uint64_t now)
+{
+    const double change = fabs(metric - h->last) /
+        fmax(fabs(h->last), 1e-12);
+
+    if (change <= HEAT_TOLERANCE)
+        h->stable++;
+    else
+        h->stable = 0;
+    h->last = metric;
+
+    return h->stable >= HEAT_STABLE_WINDOWS ||
+        now - h->begin >= heat_max_usec * 1000ULL;
+}
+
+static void
+heat_done(uint64_t ns)
+{
+    heat_time = ns;
+    if (print_stats)
+        lat_stat_add(&heat_lat, ns);
+}
+
+/*
+ * Let the target run alone at the new size. The target counters keep
+ * running with --heat-converge, and the metric of every window is
+ * the difference between two reads of the counter group.
+ */
+static void
+heat_target()
+{
+    const size_t data_size = sizeof(read_format_t) +
+        sizeof(struct ctr_data) * target_ctrs_len;
+    int cur = 0;
+
+    heat_start(&heat, lat_now());
+    if (!heat_converge) {
+        EXPECT(usleep(t_heat_usek) == 0);
+        heat_done(lat_now() - heat.begin);
+        return;
+    }
+
+    read_counter_group(target_ctrs->head->fd, heat_data[cur],
+                       target_group_len);
+    while (1) {
+        read_format_t *prev = heat_data[cur];
+        read_format_t *delta = sample_data[0];
+        uint64_t now;
+
+        EXPECT(usleep(heat_window_usec) == 0);
+        cur ^= 1;
+        read_counter_group(target_ctrs->head->fd, heat_data[cur],
+                           target_group_len);
+        now = lat_now();
+
+        memcpy(delta, heat_data[cur], data_size);
+        delta->time_running -= prev->time_running;
+        for (int i = 0; i < target_ctrs_len; i++)
+            delta->ctr[i].val -= prev->ctr[i].val;
+
+        if (heat_converged(&heat, target_metric(delta), now))
+            break;
+    }
+    /* The next period starts after the heating */
+    period_times(heat_data[cur]);
+    heat_done(lat_now() - heat.begin);
+}
+
+static void
+adaptive_add_sample()
+{
+    if (schedule.ops && schedule.ops->add)
+        schedule_add(&schedule, pirate_conf.current_size,
+                     target_metric(sample_data[0]));
+}
+
+/* Move to the next pirate size */
+static sweep_status_t
+sweep_next_size()
+{
+    uint32_t size = pirate_conf.current_size;
+    const sweep_status_t status = schedule_next(&schedule, &size);
+
+    pirate_conf.current_size = size;
+    return status;
+}
+
+/* The target needs to heat when its share of the cache grows a lot */
+static int
+needs_heat(const uint32_t old_size)
+{
+    return old_size > pirate_conf.current_size &&
+        old_size - pirate_conf.current_size >= heat_drop;
+}
+
+static void
+sweep_converged()
+{
+    fprintf(stderr, "Adaptive sweep converged after %u cycles.\n",
+            sweep_cycle + 1);
+    if (print_stats)
+        sweep_print(stderr, &schedule.sweep);
+
+    EXPECT_ERRNO(kill(target_pid, SIGKILL) == 0);
+    finalize();
+    exit(EXIT_SUCCESS);
+}
+
+/* Start a discard prefix after a size change */
+static void
+discard_arm()
+{
+    if (!discard_insns)
+        return;
+
+    /* Stop-free counters are never reset. Reset counters start from
+     * 0, but their times don't, see period_times(). */
+    if (stop_free) {
+        memcpy(discard_base, ring_prev, sizeof(read_format_t) +
+               sizeof(struct ctr_data) * target_ctrs_len);
+    } else {
+        discard_base->time_enabled = target_times.enabled;
+        discard_base->time_running = target_times.running;
+    }
+
+    /* The trigger is disabled, see discard_split(). Count a full
+     * period from here, and keep its event limit at 1, as a refresh
+     * adds to the limit that is left. */
+    EXPECT_ERRNO(ioctl(discard_ctrs.head->fd, PERF_EVENT_IOC_PERIOD,
+                       &discard_insns) != -1);
+    if (discard_limit_left)
+        EXPECT_ERRNO(ioctl(discard_ctrs.head->fd, PERF_EVENT_IOC_ENABLE, 0)
+                     != -1);
+    else
+        EXPECT_ERRNO(ioctl(discard_ctrs.head->fd, PERF_EVENT_IOC_REFRESH, 1)
+                     != -1);
+    discard_limit_left = 0;
+    discard_armed = 1;
+}
+
+static void
+handle_discard_record(const struct perf_event_header *hdr, void *data)
+{
+    const uint64_t *body = (const uint64_t *)(hdr + 1);
+
+    if (hdr->type != PERF_RECORD_SAMPLE)
+        return;
+
+    /* u64 time; struct read_format values; */
+    discard_time = body[0];
+    memcpy(discard_snap, &body[1], sizeof(read_format_t) +
+           sizeof(struct ctr_data) * target_ctrs_len);
+    *(int *)data = 1;
+}
+
+/*
+ * Split the target counters of a period that started with a size
+ * change into the prefix in discard_data and the remainder in
+ * sample_data. Returns false if the period isn't split.
+ */
+static int
+discard_split()
+{
+    read_format_t *t = sample_data[0];
+    read_format_t *prefix = discard_data[0];
+    int found = 0;
+
+    if (!discard_armed)
+        return 0;
+    discard_armed = 0;
+
+    /* Disarm the trigger even if it hasn't fired, the period is over */
+    EXPECT_ERRNO(ioctl(discard_ctrs.head->fd, PERF_EVENT_IOC_DISABLE, 0)
+                 != -1);
+    perf_ring_drain(&discard_ring, &handle_discard_record, &found);
+    discard_limit_left = !found;
+    if (!found)
+        return 0;
+
+    prefix->time_enabled = discard_snap->time_enabled -
+        discard_base->time_enabled;
+    prefix->time_running = discard_snap->time_running -
+        discard_base->time_running;
+    t->time_enabled -= prefix->time_enabled;
+    t->time_running -= prefix->time_running;
+    for (int i = 0; i < target_ctrs_len; i++) {
+        prefix->ctr[i].val = discard_snap->ctr[i].val -
+            discard_base->ctr[i].val;
+        t->ctr[i].val -= prefix->ctr[i].val;
+    }
+    return 1;
+}
+
+static void
+dump_target_sample(sample_info_t *info)
+{
+    if (discard_split()) {
+        sample_info_t prefix = *info;
+
+        prefix.phase = PHASE_DISCARD;
+        if (stop_free)
+            prefix.time = discard_time;
+        pb_dump_sample(discard_data, &prefix);
+
+        info->phase = PHASE_MEASURED;
+        info->heat_time = 0;
+    }
+    pb_dump_sample(sample_data, info);
+    heat_time = 0;
+}
+
+static void
+handle_ring_sample(uint64_t time, const read_format_t *cur)
+{
+    read_format_t *t = sample_data[0];
+
+    t->nr = cur->nr;
+    t->time_enabled = cur->time_enabled - ring_prev->time_enabled;
+    t->time_running = cur->time_running - ring_prev->time_running;
+    for (int i = 0; i < target_ctrs_len; i++)
+        t->ctr[i].val = cur->ctr[i].val - ring_prev->ctr[i].val;
+    memcpy(ring_prev, cur, sizeof(read_format_t) +
+           sizeof(struct ctr_data) * target_ctrs_len);
+
+    /* Target is heating after a large size drop */
+    if (heating) {
+        if (heat_converge ? !heat_converged(&heat, target_metric(t), time) :
+            time < heat_end)
+            return;
+        heating = 0;
+        heat_done(time - heat.begin);
+    }
+
+    for(int i = 0; i < n_pirates; i++) {
+        read_pirate_ctrs(i);
+        reset_pirate_ctrs(i);
+    }
+    for (int i = 0; i < n_bandits; i++) {
+        read_bandit_ctrs(i);
+        reset_bandit_ctrs(i);
+    }
+
+    sample_info_t info = {
+        .t_size = pirate_conf.size - pirate_conf.current_size,
+        .p_size = pirate_conf.current_size,
+        .cycle = sweep_cycle,
+        .schedule = schedule_id,
+        .time = time,
+        .size_time = size_time,
+        .heat_time = heat_time,
+        .bandit_rate = bandit_sync.rate.val,
+        .pirate_delay = gov_delay_ns,
+    };
+    dump_target_sample(&info);
+    adaptive_add_sample();
+    governor_sample();
+
+    if (pirate_conf.no_sweep)
+        return;
+
+    const uint32_t old_size = pirate_conf.current_size;
+    switch (sweep_next_size()) {
+    case SWEEP_DONE:
+        sweep_converged();
+        break;
+    case SWEEP_NEW_CYCLE:
+        sweep_cycle++;
+        rotate_bandit_rate();
+        break;
+    case SWEEP_STEP:
+        break;
+    }
+    if (needs_heat(old_size)) {
+        heating = 1;
+        heat_start(&heat, lat_now());
+        heat_end = heat.begin + t_heat_usek * 1000;
+    }
+
+    pirates_next_size();
+    size_time = lat_now();
+    /* Heating samples aren't dumped, so there is no prefix to split */
+    if (!heating)
+        discard_arm();
+}
+
+static void
+handle_ring_record(const struct perf_event_header *hdr, void *data)
+{
+    const uint64_t *body = (const uint64_t *)(hdr + 1);
+
+    switch (hdr->type) {
+    case PERF_RECORD_SAMPLE:
+        /* u64 time; struct read_format values; */
+        handle_ring_sample(body[0], (const read_format_t *)&body[1]);
+        break;
+
+    case PERF_RECORD_LOST:
+        /* u64 id; u64 lost; */
+        ring_lost += body[1];
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+drain_target_ring()
+{
+    perf_ring_drain(&target_ring, &handle_ring_record, NULL);
+}
+
 static void
 dump_all_events()
 {   
-    if(target_state != TARGET_HEATING) {
-        read_format_t *data[n_pirates+1];
+    if (stop_free) {
+        drain_target_ring();
+        return;
+    }
 
+    if(target_state != TARGET_HEATING) {
         for(int i = 0; i < n_pirates; i++)
-            data[i+1] = read_counter_list(pirate_ctrs[i].head->fd, pirate_ctrs_len);
-        data[0] = read_counter_list(perf_ctrs.head->fd, target_ctrs_len);
-
-        int p_size = pirate_conf.current_size;
-        int t_size = pirate_conf.size - p_size;
-
-        pb_dump_sample(data, t_size, p_size);
+            read_pirate_ctrs(i);
+        for (int i = 0; i < n_bandits; i++)
+            read_bandit_ctrs(i);
+        read_target_ctrs();
+
+        sample_info_t info = {
+            .t_size = pirate_conf.size - pirate_conf.current_size,
+            .p_size = pirate_conf.current_size,
+            .cycle = sweep_cycle,
+            .schedule = schedule_id,
+            .heat_time = heat_time,
+            .group = cur_group,
+            .bandit_rate = bandit_sync.rate.val,
+            .pirate_delay = gov_delay_ns,
+        };
 
-        for(int i = 0; i < (n_pirates+1) ; i++)
-            free(data[i]);
+        dump_target_sample(&info);
+        adaptive_add_sample();
+        governor_sample();
     }
 }
 
@@ -176,22 +1046,21 @@ my_ptrace_cont(int pid, int signal)
         perror("Failed to continue child process");
         abort();
     }
-}
 
-static void
-reset_events(ctr_list_t *list)
-{
-    for (ctr_t *cur = list->head; cur; cur = cur->next)
-        EXPECT_ERRNO(-1 != ioctl(cur->fd, 
-                                    PERF_EVENT_IOC_RESET, 0));
+    if (stop_begin) {
+        lat_stat_add(&stop_lat, lat_now() - stop_begin);
+        stop_begin = 0;
+    }
 }
 
 static void
 reset_all_events() 
 {
-    reset_events(&perf_ctrs);
+    reset_events(target_ctrs);
     for(int i = 0; i < n_pirates; i++)
-        reset_events(&pirate_ctrs[i]);
+        reset_pirate_ctrs(i);
+    for (int i = 0; i < n_bandits; i++)
+        reset_bandit_ctrs(i);
 }
 
 static void
@@ -220,55 +1089,67 @@ handle_child_signal(const int pid, int signal)
     case TARGET_RUNNING:
         switch (signal) {
         case SIGIO:
+            if (print_stats)
+                stop_begin = lat_now();
 
             if (pirate_conf.no_sweep){
                 dump_all_events();
                 reset_all_events();
                 my_ptrace_cont(pid, 0);
             } else {
+                const uint32_t old_size = pirate_conf.current_size;
+                sweep_status_t status;
 
-                if (pirate_conf.current_size >= \
-                    pirate_conf.size - pirate_conf.way_size) {
-
-                    dump_all_events();                
+                dump_all_events();
+                status = sweep_next_size();
+                if (status == SWEEP_DONE)
+                    sweep_converged();
+                if (status == SWEEP_NEW_CYCLE) {
+                    sweep_cycle++;
+                    rotate_ctr_groups();
+                    rotate_bandit_rate();
+                }
 
-                    EXPECT_ERRNO(-1 != ioctl(perf_ctrs.head->fd, 
-                                        PERF_EVENT_IOC_DISABLE, 0));
+                if (needs_heat(old_size)) {
 
-                    pirate_conf.current_size = 0;
+                    /* Converging needs the counters, but no overflow
+                     * signals */
+                    if (heat_converge)
+                        EXPECT_ERRNO(fcntl(target_ctrs->head->fd,
+                                           F_SETFL, 0) != -1);
+                    else
+                        EXPECT_ERRNO(-1 != ioctl(target_ctrs->head->fd, 
+                                            PERF_EVENT_IOC_DISABLE, 0));
                     
                     target_state=TARGET_HEATING;
+                    futex_word_store(&pirate_sync.hold,
+                                     pirate_sync.epoch.val + 1);
                     
-                    for(int i = 0; i < n_pirates; i++)
-                        pirate_state[i] = PIRATE_NEXT_SIZE;
-
-                    for(int i = 0; i < n_pirates; i++)
-                        while (pirate_state[i] == PIRATE_NEXT_SIZE);
+                    pirates_next_size();
                     
                     my_ptrace_cont(pid, 0);
 
-                    EXPECT(usleep(t_heat_usek) == 0);
+                    heat_target();
 
                     target_state=TARGET_RUNNING;
+                    futex_word_store(&pirate_sync.hold, 0);
 
-                    EXPECT_ERRNO(-1 != ioctl(perf_ctrs.head->fd, 
-                                        PERF_EVENT_IOC_ENABLE, 0));
+                    if (heat_converge)
+                        EXPECT_ERRNO(fcntl(target_ctrs->head->fd,
+                                           F_SETFL, O_ASYNC) != -1);
+                    else
+                        EXPECT_ERRNO(-1 != ioctl(target_ctrs->head->fd, 
+                                            PERF_EVENT_IOC_ENABLE, 0));
 
                     reset_all_events();
+                    discard_arm();
 
                 } else {
                     
-                    dump_all_events();
-                    
-                    pirate_conf.current_size+=pirate_conf.way_size;
-                    
-                    for(int i = 0; i < n_pirates; i++)
-                        pirate_state[i] = PIRATE_NEXT_SIZE;
-                    for(int i = 0; i < n_pirates; i++)
-                        while (pirate_state[i] == PIRATE_NEXT_SIZE);
-                    assert(pirate_conf.current_size > 0);
+                    pirates_next_size();
                     
                     reset_all_events();
+                    discard_arm();
                     my_ptrace_cont(pid, 0);
                 }
             }
@@ -391,6 +1272,58 @@ setup_target(void *data)
     EXPECT_ERRNO(ptrace(PTRACE_TRACEME, 0, NULL, NULL) != -1);
 }
 
+/* Called by the pirate thread itself, see pirate_snap_read() */
+static void
+pirate_publish(const int pirate_number)
+{
+    pirate_snap_t *snap = pirate_snap[pirate_number];
+    ctr_list_t *ctrs = &pirate_ctrs[pirate_number];
+    uint64_t val[pirate_ctrs_len];
+
+    if (pirate_use_rdpmc[pirate_number]) {
+        int i = 0;
+        for (ctr_t *cur = ctrs->head; cur; cur = cur->next)
+            val[i++] = ctr_read_user(cur);
+    } else {
+        uint64_t buf[sizeof(read_format_t) / sizeof(uint64_t) +
+                     pirate_ctrs_len];
+        read_format_t *data = (read_format_t *)buf;
+
+        read_counter_group(ctrs->head->fd, data, pirate_ctrs_len);
+        for (int i = 0; i < pirate_ctrs_len; i++)
+            val[i] = data->ctr[i].val;
+    }
+
+    __atomic_store_n(&snap->seq, snap->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(snap->val, val, sizeof(uint64_t) * pirate_ctrs_len);
+    __atomic_store_n(&snap->seq, snap->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void
+setup_pirate_rdpmc(const int pirate_number)
+{
+    pirate_use_rdpmc[pirate_number] = 1;
+    for (ctr_t *cur = pirate_ctrs[pirate_number].head; cur; cur = cur->next)
+        if (ctr_mmap(cur) != 1)
+            pirate_use_rdpmc[pirate_number] = 0;
+
+    if (!pirate_use_rdpmc[pirate_number])
+        fprintf(stderr, "Warning: rdpmc not available for pirate %d, "
+                "it will read its counters with read().\n", pirate_number);
+
+    pirate_publish(pirate_number);
+}
+
+static void
+pirate_pace_init(pirate_pace_t *pace, const int pirate_number)
+{
+    pace->delay = &pirate_sync.delay;
+    pace->epoch = &pirate_sync.epoch.val;
+    pace->publish = pirate_rdpmc ? &pirate_publish : NULL;
+    pace->pirate_number = pirate_number;
+}
+
 __attribute__((noinline))
 static void
 pirate_loop(char *_data, const int size, const int stride, const int pirate_number)
@@ -399,13 +1332,20 @@ pirate_loop(char *_data, const int size, const int stride, const int pirate_numb
     const int chunk = size/n_pirates;
     const int start = pirate_number*chunk;
     const int stop = start + chunk;
+    pirate_pace_t pace;
 
+    pirate_pace_init(&pace, pirate_number);
     do {
+        pirate_pace_start(&pace);
         for (int i = start; i < stop; i += stride) {
             char discard __attribute__((unused));
             discard = data[i];
+            if (!pirate_pace(&pace, 1))
+                return;
         }
-    } while (pirate_state[pirate_number] == PIRATE_RUNNING);
+        if (pirate_rdpmc)
+            pirate_publish(pirate_number);
+    } while (pirate_running(pirate_number));
 }
 
 __attribute__((noinline))
@@ -415,24 +1355,417 @@ pirate_loop_fix(char *_data, const int size, const int stride, const int pirate_
     volatile char *data = (volatile char *)_data;
     const int chunk = pirate_conf.way_size/n_pirates;
     const int start = pirate_number*chunk;
-    const int last_element = (size / pirate_conf.way_size) * MEM_HUGE_SIZE \
+    const int chunk_stride = pirate_conf.chunk_stride;
+    const int last_element = (size / pirate_conf.way_size) * chunk_stride \
         + (size % pirate_conf.way_size);
+    pirate_pace_t pace;
 
+    pirate_pace_init(&pace, pirate_number);
     do {
-        for (int i = start; i < last_element; i += MEM_HUGE_SIZE) {
+        pirate_pace_start(&pace);
+        for (int i = start; i < last_element; i += chunk_stride) {
             const int limit = MIN(i + chunk, last_element);
             for (int j = i; j < limit; j += stride) {
                 char discard __attribute__((unused));
                 discard = data[j];
+                if (!pirate_pace(&pace, 1))
+                    return;
             }
         } 
-    } while (pirate_state[pirate_number] == PIRATE_RUNNING);
+        if (pirate_rdpmc)
+            pirate_publish(pirate_number);
+    } while (pirate_running(pirate_number));
+}
+
+/* Distance between the way sized chunks of the data set */
+static inline int
+way_chunk_stride(const pirate_conf_t *conf)
+{
+    return conf->loop_fix ? conf->chunk_stride : conf->way_size;
+}
+
+/*
+ * The random kernel chases pointers through the cache lines of each
+ * way sized chunk. Every chunk is split between the pirates and every
+ * pirate's part of a chunk is a single cycle through all of its lines
+ * in random order, starting at the first line of the part. The cycles
+ * don't depend on the pirate size, so they are built once in
+ * setup_pirate() and every size step just follows them for as many
+ * lines as it needs.
+ */
+__attribute__((noinline))
+static void
+pirate_loop_random(char *data, const int size, const int stride,
+                   const int pirate_number)
+{
+    const int part = pirate_conf.way_size / n_pirates;
+    const int lines = part / stride;
+    const int full_chunks = size / pirate_conf.way_size;
+    const int last_lines = (size % pirate_conf.way_size) / n_pirates / stride;
+    const int chunk_stride = way_chunk_stride(&pirate_conf);
+    void * volatile sink __attribute__((unused));
+    pirate_pace_t pace;
+
+    pirate_pace_init(&pace, pirate_number);
+    do {
+        pirate_pace_start(&pace);
+        for (int c = 0; c <= full_chunks; c++) {
+            void **p = (void **)(data + c * chunk_stride + pirate_number * part);
+            int n = c < full_chunks ? lines : last_lines;
+
+            while (n--) {
+                p = (void **)*p;
+                if (!pirate_pace(&pace, 1))
+                    return;
+            }
+            sink = p;
+        }
+        if (pirate_rdpmc)
+            pirate_publish(pirate_number);
+    } while (pirate_running(pirate_number));
+}
+
+/*
+ * The color kernel walks a list of lines with the same number of
+ * lines in every cache set, picked by physical address, see
+ * build_color_list(). Each way level of the list is split between the
+ * pirates like a way sized chunk of the other kernels. The sets that
+ * don't divide evenly, and the lines of a partial level, are spread
+ * over the pirates so that every set is covered.
+ */
+__attribute__((noinline))
+static void
+pirate_loop_color(char *_data, const int size, const int stride,
+                  const int pirate_number)
+{
+    volatile char *data = (volatile char *)_data;
+    const uint32_t *list = pirate_conf.color_list;
+    const int n_sets = pirate_conf.n_sets;
+    const int start = (int64_t)pirate_number * n_sets / n_pirates;
+    const int stop = (int64_t)(pirate_number + 1) * n_sets / n_pirates;
+    const int part = stop - start;
+    const int lines = size / stride;
+    const int full_levels = MIN(lines / n_sets, pirate_conf.ways);
+    const int64_t last_level = lines % n_sets;
+    const int last_lines = stop * last_level / n_sets -
+        start * last_level / n_sets;
+    pirate_pace_t pace;
+
+    pirate_pace_init(&pace, pirate_number);
+    do {
+        pirate_pace_start(&pace);
+        for (int w = 0; w <= full_levels && w < pirate_conf.ways; w++) {
+            const uint32_t *level = list + w * n_sets + start;
+            const int n = w < full_levels ? part : last_lines;
+
+            for (int i = 0; i < n; i++) {
+                char discard __attribute__((unused));
+                discard = data[level[i]];
+                if (!pirate_pace(&pace, 1))
+                    return;
+            }
+        }
+        if (pirate_rdpmc)
+            pirate_publish(pirate_number);
+    } while (pirate_running(pirate_number));
+}
+
+static uint64_t
+slice_misses()
+{
+    static union {
+        read_format_t data;
+        char buf[sizeof(read_format_t) + sizeof(struct ctr_data)];
+    } r;
+
+    read_counter_group(slice_ctrs.head->fd, &r.data, 1);
+    return r.data.ctr[0].val;
+}
+
+/* Does accessing set[] (twice) evict x from the LLC? */
+static int
+slice_evicts(void *arg, uint32_t x, const uint32_t *set, int n)
+{
+    volatile char *data = (volatile char *)pirate_conf.data;
+    int votes = 0;
+
+    for (int r = 0; r < SLICE_TEST_REPS; r++) {
+        char discard __attribute__((unused));
+        uint64_t before;
+
+        discard = data[x];
+        for (int pass = 0; pass < 2; pass++)
+            for (int i = 0; i < n; i++)
+                discard = data[set[i]];
+
+        before = slice_misses();
+        discard = data[x];
+        votes += slice_misses() != before;
+    }
+
+    return votes > SLICE_TEST_REPS / 2;
+}
+
+/*
+ * Label every line of the data set with its slice, relative to its
+ * set index within the slice, see slice.h. The lines of SLICE_CAL_SETS
+ * set indexes are split into slices with eviction tests on the first
+ * pirate CPU, which shares the LLC with the target, and a linear slice
+ * hash is fit to them.
+ *
+ * @return Number of set indexes that were split, 0 if the hash
+ *         doesn't explain the data set.
+ */
+static int
+calibrate_slices(const pirate_conf_t *conf, const uint64_t *phys,
+                 int8_t *label)
+{
+    const long page = sysconf(_SC_PAGESIZE);
+    const int n_lines = conf->alloc_size / conf->stride;
+    const int sets_per_slice = conf->way_size / conf->stride / n_slices;
+    /* Line offset and set index bits */
+    const uint64_t set_mask = (uint64_t)sets_per_slice * conf->stride - 1;
+    cpu_set_t old_cpus, cpus;
+    slice_hash_t hash;
+    uint32_t *cand;
+    int *slice;
+    int tested = 0;
+
+    if ((conf->way_size / conf->stride) % n_slices ||
+        sets_per_slice & (sets_per_slice - 1)) {
+        fprintf(stderr, "Warning: %d sets don't split into %d slices "
+                "with a power of two sets each.\n",
+                conf->way_size / conf->stride, n_slices);
+        return 0;
+    }
+
+    EXPECT(cand = malloc(n_lines * sizeof(*cand)));
+    EXPECT(slice = malloc(n_lines * sizeof(*slice)));
+
+    EXPECT(pthread_getaffinity_np(pthread_self(), sizeof(old_cpus),
+                                  &old_cpus) == 0);
+    CPU_ZERO(&cpus);
+    CPU_SET(pirate_cpus[0], &cpus);
+    EXPECT(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+
+    slice_ctrs.head = slice_ctrs.tail = NULL;
+    setup_ctr("PERF_COUNT_HW_CACHE_MISSES", &slice_ctrs);
+    EXPECT(ctrs_attach(&slice_ctrs, 0, -1, 0) != -1);
+
+    slice_hash_init(&hash, n_slices);
+    for (int c = 0; c < SLICE_CAL_SETS; c++) {
+        const uint64_t set = (uint64_t)c * sets_per_slice / SLICE_CAL_SETS;
+        int n = 0;
+
+        for (int l = 0; l < n_lines; l++) {
+            const uint32_t offset = (uint32_t)l * conf->stride;
+            const uint64_t addr = phys[offset / page] + offset % page;
+
+            if ((addr & set_mask) / conf->stride == set)
+                cand[n++] = offset;
+        }
+
+        if (slice_split(cand, n, conf->ways, n_slices, &slice_evicts, NULL,
+                        slice) != n_slices)
+            continue;
+        tested++;
+
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n && slice[i] >= 0; j++) {
+                if (slice[j] == slice[i]) {
+                    slice_hash_same(&hash,
+                                    phys[cand[i] / page] + cand[i] % page,
+                                    phys[cand[j] / page] + cand[j] % page);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int l = 0; l < n_lines && tested; l++) {
+        const uint32_t offset = (uint32_t)l * conf->stride;
+        const uint64_t addr = phys[offset / page] + offset % page;
+
+        if ((label[l] = slice_hash_id(&hash, addr & ~set_mask)) < 0)
+            tested = 0;
+    }
+
+    close(slice_ctrs.head->fd);
+    EXPECT(pthread_setaffinity_np(pthread_self(), sizeof(old_cpus),
+                                  &old_cpus) == 0);
+    free(slice);
+    free(cand);
+    return tested;
+}
+
+/*
+ * Pirate lines in each slice at every number of ways. A level of the
+ * color list alternates between the slices when they are balanced,
+ * the list is only known to be balanced then.
+ */
+static void
+slice_occupancy(const pirate_conf_t *conf)
+{
+    slice_occ_len = conf->ways * n_slices;
+    EXPECT(slice_occ = calloc(slice_occ_len, sizeof(*slice_occ)));
+    for (int w = 0; w < conf->ways; w++) {
+        for (int s = 0; s < n_slices; s++)
+            slice_occ[w * n_slices + s] =
+                (w ? slice_occ[(w - 1) * n_slices + s] : 0) +
+                conf->n_sets / n_slices;
+    }
+}
+
+/*
+ * Pick ways lines of every cache set from the data set, which is
+ * COLOR_SLACK times larger than the cache. The set of a line is
+ * (physical address / line size) % sets, with the physical addresses
+ * from /proc/self/pagemap. The virtual addresses stand in for them if
+ * pagemap hides the frame numbers, which is only exact when the pages
+ * are at least as large as a way.
+ */
+static void
+build_color_list(pirate_conf_t *conf)
+{
+    const long page = sysconf(_SC_PAGESIZE);
+    const int n_pages = conf->alloc_size / page;
+    const int n_lines = conf->alloc_size / conf->stride;
+    const int n_sets = conf->way_size / conf->stride;
+    uint64_t *phys;
+    int *fill;
+    int short_sets = 0;
+    /* Slice of every line, --slices only */
+    int8_t *label = NULL;
+
+    EXPECT(n_sets >= n_pirates);
+    EXPECT(phys = malloc(n_pages * sizeof(*phys)));
+    EXPECT(fill = calloc(n_sets, sizeof(*fill)));
+    EXPECT(conf->color_list = malloc((size_t)conf->ways * n_sets *
+                                     sizeof(*conf->color_list)));
+
+    /* pagemap only has frame numbers for present pages */
+    for (int i = 0; i < conf->alloc_size; i += page)
+        ((volatile char *)conf->data)[i] = 0;
+
+    color_physical = mem_phys_pages(conf->data, conf->alloc_size, phys) == 0;
+    if (!color_physical) {
+        fprintf(stderr, "Warning: /proc/self/pagemap has no physical "
+                "addresses (needs CAP_SYS_ADMIN), coloring by virtual "
+                "address.\n");
+        for (int i = 0; i < n_pages; i++)
+            phys[i] = (uint64_t)(uintptr_t)conf->data + (uint64_t)i * page;
+    }
+
+    if (n_slices) {
+        EXPECT(label = malloc(n_lines));
+        if (!(slice_tested_sets = calibrate_slices(conf, phys, label))) {
+            fprintf(stderr, "Warning: LLC slice calibration failed, the "
+                    "pirate lines aren't balanced across slices.\n");
+            free(label);
+            label = NULL;
+        }
+    }
+
+    for (int l = 0; l < n_lines; l++) {
+        const uint32_t offset = (uint32_t)l * conf->stride;
+        const uint64_t addr = phys[offset / page] + offset % page;
+        /* With slices, every set index has a set in each slice, and the
+         * sets of a level alternate between the slices */
+        const int set = label ?
+            (addr / conf->stride) % (n_sets / n_slices) * n_slices + label[l] :
+            (addr / conf->stride) % n_sets;
+
+        if (fill[set] < conf->ways)
+            conf->color_list[fill[set]++ * n_sets + set] = offset;
+    }
+
+    for (int s = 0; s < n_sets; s++)
+        short_sets += fill[s] < conf->ways;
+    if (short_sets) {
+        fprintf(stderr, "Error: %i of %i cache sets have less than %i lines "
+                "in the data set.\n", short_sets, n_sets, conf->ways);
+        exit(EXIT_FAILURE);
+    }
+
+    conf->n_sets = n_sets;
+    if (label)
+        slice_occupancy(conf);
+    free(label);
+    free(fill);
+    free(phys);
+}
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void
+build_random_chains(pirate_conf_t *conf)
+{
+    const int part = conf->way_size / n_pirates;
+    const int lines = part / conf->stride;
+    const int chunks = conf->alloc_size / way_chunk_stride(conf);
+    uint64_t seed = RANDOM_KERNEL_SEED;
+    int *order;
+
+    EXPECT(lines > 0);
+    EXPECT(order = malloc(lines * sizeof(int)));
+
+    for (int c = 0; c < chunks; c++) {
+        for (int p = 0; p < n_pirates; p++) {
+            char *base = (char *)conf->data + c * way_chunk_stride(conf) +
+                p * part;
+
+            for (int i = 0; i < lines; i++)
+                order[i] = i;
+            for (int i = lines - 1; i > 0; i--) {
+                const int j = xorshift64(&seed) % (i + 1);
+                const int tmp = order[i];
+                order[i] = order[j];
+                order[j] = tmp;
+            }
+
+            for (int i = 0; i < lines; i++)
+                *(void **)(base + order[i] * conf->stride) =
+                    base + order[(i + 1) % lines] * conf->stride;
+        }
+    }
+
+    free(order);
 }
 
 static void
 run_pirate_loop(const pirate_conf_t *conf, const pirate_pthread_conf_t *pth_conf) 
 {
-    if (conf->loop_fix){
+    if (conf->kernel == PIRATE_KERNEL_MLP) {
+        const pirate_kernel_args_t args = {
+            .data = conf->data,
+            .size = conf->current_size,
+            .stride = conf->stride,
+            .way_size = conf->way_size,
+            .chunk_stride = way_chunk_stride(conf),
+            .loop_fix = conf->loop_fix,
+            .n_pirates = n_pirates,
+            .pirate_number = pth_conf->pirate_number,
+            .epoch = &pirate_sync.epoch.val,
+            .run_epoch = pirate_slot[pth_conf->pirate_number].run_epoch,
+            .publish = pirate_rdpmc ? &pirate_publish : NULL,
+            .delay = &pirate_sync.delay,
+        };
+        pirate_loop_variant(&args, conf->variant);
+    } else if (conf->kernel == PIRATE_KERNEL_RANDOM) {
+        pirate_loop_random(conf->data, conf->current_size, \
+                           conf->stride, pth_conf->pirate_number);
+    } else if (conf->kernel == PIRATE_KERNEL_COLOR) {
+        pirate_loop_color(conf->data, conf->current_size, \
+                          conf->stride, pth_conf->pirate_number);
+    } else if (conf->loop_fix){
         pirate_loop_fix(conf->data, conf->current_size, \
                         conf->stride, pth_conf->pirate_number);
     } else {
@@ -453,10 +1786,61 @@ run_pirate_loop(const pirate_conf_t *conf, const pirate_pthread_conf_t *pth_conf
 //     return numToRound + multiple - remainder; 
 // }  
 
+/**
+ * Measure the access rate of the strided kernel and every mlp kernel
+ * variant at the reference size and switch to the fastest one. Only
+ * the first pirate runs, the others wait at the barrier.
+ */
+static void
+pirate_calibrate(pirate_conf_t *conf, pirate_pthread_conf_t *pth_conf)
+{
+    pirate_conf_t temp_conf = *conf;
+    const int n_variants = pirate_variants_init(conf->stride);
+    double best_rate = 0;
+    uint64_t lines;
+
+    temp_conf.current_size = temp_conf.size/2;
+    lines = temp_conf.current_size / n_pirates / temp_conf.stride;
+
+    /* Variant -1 is the strided kernel */
+    for (int v = -1; v < n_variants; v++) {
+        const char *name;
+        uint64_t begin, elapsed;
+        double rate;
+        int passes = 0;
+
+        temp_conf.kernel = v < 0 ? PIRATE_KERNEL_STRIDE : PIRATE_KERNEL_MLP;
+        temp_conf.variant = v;
+        name = v < 0 ? pirate_kernel_name(PIRATE_KERNEL_STRIDE) :
+            pirate_variant(v)->name;
+
+        run_pirate_loop(&temp_conf, pth_conf); //Warm up pirate
+
+        begin = lat_now();
+        do {
+            run_pirate_loop(&temp_conf, pth_conf);
+            passes++;
+        } while ((elapsed = lat_now() - begin) < CALIBRATE_NSEC);
+
+        rate = (double)lines * passes * 1e9 / elapsed;
+        pb_write_calibration(name, rate, passes, elapsed);
+        if (rate > best_rate) {
+            best_rate = rate;
+            conf->kernel = temp_conf.kernel;
+            conf->variant = v;
+        }
+    }
+
+    fprintf(stderr, "Pirate kernel: %s\n",
+            conf->kernel == PIRATE_KERNEL_MLP ?
+            pirate_variant(conf->variant)->name :
+            pirate_kernel_name(conf->kernel));
+}
+
 static void
 pirate_reference(ctr_list_t *ctrs, pirate_conf_t *conf, pirate_pthread_conf_t *pth_conf)
 {
-    read_format_t *data;
+    read_format_t *data = sample_data[pth_conf->pirate_number + 1];
     pirate_conf_t temp_conf = *conf;
     temp_conf.current_size = temp_conf.size/2; //roundUp(2*temp_conf.l2_size, temp_conf.way_size);
     run_pirate_loop(&temp_conf, pth_conf); //Warm up pirate
@@ -464,11 +1848,38 @@ pirate_reference(ctr_list_t *ctrs, pirate_conf_t *conf, pirate_pthread_conf_t *p
 
     reset_events(ctrs);
     run_pirate_loop(&temp_conf, pth_conf); //Reference run
-    data = read_counter_list(ctrs->head->fd, pirate_ctrs_len);
+    read_counter_group(ctrs->head->fd, data, pirate_ctrs_len);
 
     pb_write_reference(data, temp_conf.current_size);
 
-    free(data);
+    if (temp_conf.kernel != PIRATE_KERNEL_STRIDE) {
+        /* Reference for the strided kernel, for comparison */
+        temp_conf.kernel = PIRATE_KERNEL_STRIDE;
+        run_pirate_loop(&temp_conf, pth_conf);
+        run_pirate_loop(&temp_conf, pth_conf);
+
+        reset_events(ctrs);
+        run_pirate_loop(&temp_conf, pth_conf);
+        read_counter_group(ctrs->head->fd, data, pirate_ctrs_len);
+
+        pb_write_kernel_reference(pirate_kernel_name(temp_conf.kernel),
+                                  data, temp_conf.current_size);
+    }
+}
+
+/* pirate_delay() loops per ns, from the fastest of a few timings */
+static double
+calibrate_delay()
+{
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < GOVERNOR_CAL_RUNS; i++) {
+        const uint64_t begin = lat_now();
+
+        pirate_delay(GOVERNOR_CAL_LOOPS);
+        best = MIN(best, lat_now() - begin);
+    }
+    return (double)GOVERNOR_CAL_LOOPS / MAX(best, 1);
 }
 
 static void *
@@ -476,6 +1887,7 @@ pirate_main(void *_conf)
 {
     pirate_pthread_conf_t *pth_conf = (pirate_pthread_conf_t *)_conf;
     pirate_conf_t *conf = &pirate_conf;
+    pirate_slot_t *slot = &pirate_slot[pth_conf->pirate_number];
 
     pthread_t thread;   
     cpu_set_t cpu_set;
@@ -486,9 +1898,11 @@ pirate_main(void *_conf)
     EXPECT(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpu_set) == 0);
 
     /** Write some data to the data array, this makes sure that we get
-     * backing storage for the entire allocation */
-    for (int i = 0; i < conf->alloc_size; i += conf->stride)
-        ((char *)conf->data)[i] = i & 0xFF;
+     * backing storage for the entire allocation. The random kernel's
+     * pointers have already been written to every line. */
+    if (conf->kernel != PIRATE_KERNEL_RANDOM)
+        for (int i = 0; i < conf->alloc_size; i += conf->stride)
+            ((char *)conf->data)[i] = i & 0xFF;
 
     /* TODO: Check if this is a PID or TID */
     EXPECT(ctrs_attach(&pirate_ctrs[pth_conf->pirate_number],
@@ -496,75 +1910,257 @@ pirate_main(void *_conf)
                        -1, //conf->cpu
                        0 /* flags */) != -1);
 
+    if (pirate_rdpmc)
+        setup_pirate_rdpmc(pth_conf->pirate_number);
+
     if(pth_conf->pirate_number == 0) {
+        if (conf->kernel == PIRATE_KERNEL_AUTO) {
+            pirate_calibrate(conf, pth_conf);
+            pb_write_kernel(conf);
+        }
         if(!conf->no_reference)
             pirate_reference(&pirate_ctrs[0], conf, pth_conf);
+        /* The delay loop runs at the speed of a pirate CPU */
+        if (gov_threshold) {
+            delay_loops_per_ns = calibrate_delay();
+            pb_write_governor(gov_threshold, delay_loops_per_ns);
+        }
         pb_header2file();
     }
 
     pthread_barrier_wait(&pirate_barrier);
 
     while (1) {
+            const uint32_t epoch = __atomic_load_n(&pirate_sync.epoch.val,
+                                                   __ATOMIC_ACQUIRE);
 
+            /* A past epoch makes the kernel do a single pass */
+            slot->run_epoch = epoch - 1;
             run_pirate_loop(conf, pth_conf); /* Warming pirate */
-            
-            pirate_state[pth_conf->pirate_number]=PIRATE_RUNNING;
-            while(target_state == TARGET_HEATING);
+            pirate_arrive(pth_conf->pirate_number, epoch);
+
+            futex_word_wait(&pirate_sync.hold, epoch);
 
+            slot->run_epoch = epoch;
             run_pirate_loop(conf, pth_conf);
     }
 
-    pirate_state[pth_conf->pirate_number] = PIRATE_FINISHED;
-    fprintf(stderr, "Pirate finished...\n");
     return NULL;
 }
 
+/*
+ * Write len bytes with non-temporal stores, which go to memory
+ * through the write combining buffers without allocating lines in the
+ * caches. Other architectures fall back to plain stores.
+ */
+__attribute__((noinline))
+static void
+bandit_stream(char *data, const size_t len)
+{
+#if defined(__x86_64__)
+    const __m128i val = _mm_set1_epi32(1);
+
+    for (size_t i = 0; i < len; i += sizeof(__m128i))
+        _mm_stream_si128((__m128i *)(data + i), val);
+    _mm_sfence();
+#else
+    for (size_t i = 0; i < len; i += sizeof(uint64_t))
+        *(volatile uint64_t *)(data + i) = i;
+#endif
+}
+
+static void *
+bandit_main(void *_slot)
+{
+    bandit_slot_t *slot = (bandit_slot_t *)_slot;
+    char *data = slot->mem.addr;
+    cpu_set_t cpu_set;
+    uint64_t next, now;
+    size_t pos = 0;
+
+    CPU_ZERO(&cpu_set);
+    CPU_SET(slot->cpu, &cpu_set);
+    EXPECT(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                  &cpu_set) == 0);
+
+    EXPECT(ctrs_attach(&bandit_ctrs[slot->bandit_number],
+                       0 /* pid */, -1 /* cpu */, 0 /* flags */) != -1);
+
+    pthread_barrier_wait(&pirate_barrier);
+
+    next = lat_now();
+    while (1) {
+        const uint32_t rate = bandit_sync.rate.val;
+
+        if (!rate) {
+            futex_word_wait(&bandit_sync.rate, 0);
+            next = lat_now();
+            continue;
+        }
+
+        bandit_stream(data + pos, BANDIT_CHUNK);
+        pos = (pos + BANDIT_CHUNK) % bandit_size;
+        __atomic_store_n(&slot->bytes, slot->bytes + BANDIT_CHUNK,
+                         __ATOMIC_RELAXED);
+
+        if (rate == BANDIT_RATE_MAX)
+            continue;
+
+        /* A MB/s is a byte per microsecond. A bandit that fell far
+         * behind, or just got throttled, starts over instead of
+         * catching up at full speed. */
+        next += BANDIT_CHUNK * 1000ULL / rate;
+        now = lat_now();
+        if (now > next + BANDIT_MAX_LAG_NSEC)
+            next = now;
+        while (now < next) {
+            cpu_relax();
+            now = lat_now();
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ctr_group_add(ctr_group_t *group, const ctr_t *ctr, const int idx)
+{
+    ctr_t *copy;
+
+    EXPECT(copy = ctr_create(&ctr->attr));
+    copy->event_name = ctr->event_name;
+    ctrs_add(&group->ctrs, copy);
+    group->idx[group->len++] = idx;
+}
+
+/* Split the target events in groups of group_size counters */
+static void
+setup_ctr_groups()
+{
+    const int per_group = group_size - 1;
+    const ctr_t *event = perf_ctrs.head->next;
+
+    n_ctr_groups = (target_ctrs_len - 1 + per_group - 1) / per_group;
+    EXPECT(ctr_groups = calloc(n_ctr_groups, sizeof(ctr_group_t)));
+    for (int i = 0; i < n_ctr_groups; i++) {
+        ctr_group_t *group = &ctr_groups[i];
+
+        EXPECT(group->idx = malloc(group_size * sizeof(int)));
+        ctr_group_add(group, perf_ctrs.head, 0);
+        for (int j = 0; j < per_group && event; j++, event = event->next)
+            ctr_group_add(group, event, 1 + i * per_group + j);
+    }
+
+    target_ctrs = &ctr_groups[0].ctrs;
+    target_group_len = ctr_groups[0].len;
+    fprintf(stderr, "Multiplexing %d target events in %d groups.\n",
+            target_ctrs_len - 1, n_ctr_groups);
+}
+
+/*
+ * Add the --discard trigger to the target group. The target is
+ * traced and stops at its exec, so the trigger is in place before
+ * the target runs, and it only counts once discard_arm() enables it.
+ */
+static void
+setup_discard()
+{
+    struct perf_event_attr *attr;
+
+    setup_ctr("PERF_COUNT_HW_INSTRUCTIONS", &discard_ctrs);
+    attr = &discard_ctrs.head->attr;
+    attr->sample_period = discard_insns;
+    attr->freq = 0;
+    attr->sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_READ;
+    attr->disabled = 1;
+    attr->enable_on_exec = 0;
+#ifdef PERF_ATTR_SIZE_VER5
+    attr->use_clockid = perf_ctrs.head->attr.use_clockid;
+    attr->clockid = perf_ctrs.head->attr.clockid;
+#endif
+
+    EXPECT(ctr_attach(discard_ctrs.head, target_pid, -1,
+                      target_ctrs->head->fd, 0) != -1);
+    EXPECT(perf_ring_open(&discard_ring, discard_ctrs.head->fd,
+                          DISCARD_RING_PAGES) == 0);
+}
 
 static void
 do_start()
 {
     int sfd;
 
-    if (perf_ctrs.head) {
-        perf_ctrs.head->attr.disabled = 1;
-        perf_ctrs.head->attr.enable_on_exec = 1;
+    if (target_ctrs->head) {
+        target_ctrs->head->attr.disabled = 1;
+        target_ctrs->head->attr.enable_on_exec = 1;
     }
     sfd = create_sig_fd();
 
     /* Start pirate */
-    EXPECT(pthread_barrier_init(&pirate_barrier, NULL, n_pirates + 1) == 0);
+    EXPECT(pthread_barrier_init(&pirate_barrier, NULL,
+                                n_pirates + n_bandits + 1) == 0);
     for(int i = 0; i < n_pirates; i++){
         fprintf(stderr, "Starting pirate on CPU %d...\n",
                             pirate_pthread_conf[i].cpu);
         EXPECT(pthread_create(&pirate_thread[i], NULL,
                               &pirate_main, &pirate_pthread_conf[i]) == 0);
     }
+    for (int i = 0; i < n_bandits; i++) {
+        fprintf(stderr, "Starting bandit on CPU %d...\n",
+                bandit_slot[i].cpu);
+        EXPECT(pthread_create(&bandit_thread[i], NULL,
+                              &bandit_main, &bandit_slot[i]) == 0);
+    }
     pthread_barrier_wait(&pirate_barrier);
 
     /* Wait for pirate to heat when not sampling */
     if(pirate_conf.no_sweep)
-        for(int i = 0; i < n_pirates; i++)
-            while (pirate_state[i] == PIRATE_NEXT_SIZE);
+        futex_word_wait(&pirate_sync.done, 0);
 
     
     /* Start target */
-    target_pid = ctrs_execvp_cb(&perf_ctrs, -1 /* cpu */, 0 /* flags */,
+    target_pid = ctrs_execvp_cb(target_ctrs, -1 /* cpu */, 0 /* flags */,
                                 &setup_target, NULL,
                                 exec_argv[0], exec_argv);
     EXPECT(target_pid != -1);
+    /* The other groups wait for their turn, see rotate_ctr_groups() */
+    for (int i = 1; i < n_ctr_groups; i++) {
+        ctr_t *leader = ctr_groups[i].ctrs.head;
+
+        leader->attr.disabled = 1;
+        leader->attr.enable_on_exec = 0;
+        EXPECT(ctrs_attach(&ctr_groups[i].ctrs, target_pid, -1, 0) != -1);
+        EXPECT_ERRNO(fcntl(leader->fd, F_SETOWN, target_pid) != -1);
+    }
+    if (discard_insns)
+        setup_discard();
     
 
-     /* Route SIGIO from the perf FD to the child process */
-    EXPECT_ERRNO(fcntl(perf_ctrs.head->fd, F_SETOWN, target_pid) != -1);
-    EXPECT_ERRNO(fcntl(perf_ctrs.head->fd, F_SETFL, O_ASYNC) != -1);
+    if (stop_free) {
+        /* Samples are drained from the sample buffer, the target is
+         * never stopped for them */
+        EXPECT(perf_ring_open(&target_ring, target_ctrs->head->fd,
+                              STOP_FREE_RING_PAGES) == 0);
+        EXPECT(ring_prev = calloc(1, sizeof(read_format_t) +
+                                  sizeof(struct ctr_data) * target_ctrs_len));
+        size_time = lat_now();
+    } else {
+        /* Route SIGIO from the perf FD to the child process */
+        EXPECT_ERRNO(fcntl(target_ctrs->head->fd, F_SETOWN, target_pid) != -1);
+        EXPECT_ERRNO(fcntl(target_ctrs->head->fd, F_SETFL, O_ASYNC) != -1);
+    }
 
     reset_all_events();
 
     while (1) {//pirate_state != PIRATE_FINISHED) {
         struct pollfd pfd[] = {
-            { sfd, POLLIN, 0 }
+            { sfd, POLLIN, 0 },
+            { stop_free ? target_ctrs->head->fd : -1, POLLIN, 0 },
         };
         if (poll(pfd, sizeof(pfd) / sizeof(*pfd), -1) != -1) {
+            if (pfd[1].revents & POLLIN)
+                drain_target_ring();
             if (pfd[0].revents & POLLIN){
                 handle_signal(sfd);
                 // fprintf(stderr, "Got signal\n");
@@ -597,7 +2193,7 @@ static int
 file_to_int(char *syspath, char file[])
 {
     FILE *fp;
-    char buf[100];
+    char buf[300];
     int val;
     char factor;
 
@@ -627,16 +2223,13 @@ static void
 read_cache_conf() 
 {
 
-    char syspath[100];
-    int LLCindex = -1;
+    char syspath[256];
 
-    do {
-        LLCindex++;
-        sprintf(syspath, "/sys/devices/system/cpu/cpu%d/cache/index%d/size", target_cpu, LLCindex);
-    } while( access(syspath, F_OK) == 0 );
-    LLCindex--;
-    sprintf(syspath, "/sys/devices/system/cpu/cpu%d/cache/index%d/", target_cpu, LLCindex);
-    
+    if (topo_llc_path(target_cpu, syspath, sizeof(syspath)) != 0) {
+        fprintf(stderr, "Can't find the last level cache of CPU %d.\n",
+                target_cpu);
+        exit(EXIT_FAILURE);
+    }
 
     pirate_conf.ways = file_to_int(syspath, "ways_of_associativity");
     pirate_conf.size = file_to_int(syspath, "size");
@@ -644,6 +2237,117 @@ read_cache_conf()
 
 }
 
+static void
+setup_sample_buffer()
+{
+    const size_t t_bytes = sizeof(read_format_t) +
+        sizeof(struct ctr_data) * MAX(target_ctrs_len, target_group_len);
+    const size_t p_bytes = sizeof(read_format_t) +
+        sizeof(struct ctr_data) * pirate_ctrs_len;
+    /* The bytes written follow the counters of a bandit */
+    const size_t b_bytes = sizeof(read_format_t) +
+        sizeof(struct ctr_data) * (bandit_ctrs_len + 1);
+    const size_t bytes = t_bytes + n_pirates * p_bytes + n_bandits * b_bytes;
+    const int n_data = n_pirates + n_bandits + 1;
+    char *buf;
+
+    EXPECT(sample_data = malloc(n_data * sizeof(read_format_t *)));
+    EXPECT(posix_memalign(&sample_buf, 64, bytes) == 0);
+    memset(sample_buf, '\0', bytes);
+
+    buf = sample_buf;
+    sample_data[0] = (read_format_t *)buf;
+    buf += t_bytes;
+    for (int i = 0; i < n_pirates; i++, buf += p_bytes)
+        sample_data[i + 1] = (read_format_t *)buf;
+    for (int i = 0; i < n_bandits; i++, buf += b_bytes)
+        sample_data[n_pirates + i + 1] = (read_format_t *)buf;
+
+    if (heat_converge)
+        for (int i = 0; i < 2; i++)
+            EXPECT(heat_data[i] = calloc(1, t_bytes));
+
+    if (n_ctr_groups)
+        EXPECT(group_data = calloc(1, t_bytes));
+
+    if (discard_insns) {
+        /* Every pirate and bandit of the prefix points to the same
+         * zero buffer */
+        read_format_t *zero;
+
+        EXPECT(discard_base = calloc(1, t_bytes));
+        EXPECT(discard_snap = calloc(1, t_bytes));
+        EXPECT(zero = calloc(1, MAX(p_bytes, b_bytes)));
+        EXPECT(discard_data = malloc(n_data * sizeof(read_format_t *)));
+        EXPECT(discard_data[0] = calloc(1, t_bytes));
+        for (int i = 1; i < n_data; i++)
+            discard_data[i] = zero;
+    }
+
+    if (pirate_rdpmc) {
+        /* Give every snapshot its own cache lines */
+        const size_t snap_bytes = (sizeof(pirate_snap_t) +
+            sizeof(uint64_t) * pirate_ctrs_len + 63) & ~(size_t)63;
+
+        EXPECT(pirate_snap = malloc(n_pirates * sizeof(pirate_snap_t *)));
+        EXPECT(pirate_use_rdpmc = calloc(n_pirates, sizeof(int)));
+        EXPECT(pirate_base = calloc(n_pirates * pirate_ctrs_len,
+                                    sizeof(uint64_t)));
+        for (int i = 0; i < n_pirates; i++) {
+            EXPECT(posix_memalign((void **)&pirate_snap[i], 64,
+                                  snap_bytes) == 0);
+            memset(pirate_snap[i], '\0', snap_bytes);
+        }
+    }
+}
+
+static void
+setup_bandits()
+{
+    if (!n_bandits)
+        return;
+
+    if (!bandit_size)
+        bandit_size = (uint64_t)BANDIT_LLC_SCALE * pirate_conf.size;
+    bandit_size = ROUND_UP(bandit_size, BANDIT_CHUNK);
+    if (bandit_size < (uint64_t)BANDIT_LLC_SCALE * pirate_conf.size)
+        fprintf(stderr, "Warning: The bandit buffers are smaller than "
+                "%d times the LLC, the bandits may hold cache "
+                "capacity.\n", BANDIT_LLC_SCALE);
+
+    if (!n_bandit_rates) {
+        EXPECT(bandit_rates = malloc(sizeof(uint32_t)));
+        bandit_rates[n_bandit_rates++] = BANDIT_RATE_MAX;
+    }
+    bandit_sync.rate.val = bandit_rates[0];
+
+    EXPECT(bandit_ctrs = malloc(n_bandits * sizeof(ctr_list_t)));
+    EXPECT(bandit_thread = malloc(n_bandits * sizeof(pthread_t)));
+    EXPECT(posix_memalign((void **)&bandit_slot, CACHE_LINE_SIZE,
+                          n_bandits * sizeof(bandit_slot_t)) == 0);
+    memset(bandit_slot, 0, n_bandits * sizeof(bandit_slot_t));
+
+    for (int i = 0; i < n_bandits; i++) {
+        bandit_slot_t *slot = &bandit_slot[i];
+
+        slot->cpu = bandit_cpus[i];
+        slot->bandit_number = i;
+        /* Huge pages keep the stream free of TLB misses, but the
+         * hugetlb pool is left for the pirates */
+        EXPECT_ERRNO(mem_huge_alloc(&slot->mem, bandit_size,
+                                    MEM_PAGES_THP) == 0);
+
+        bandit_ctrs[i].head = NULL;
+        bandit_ctrs[i].tail = NULL;
+        setup_ctr("PERF_COUNT_HW_INSTRUCTIONS", &bandit_ctrs[i]);
+        setup_ctr("PERF_COUNT_HW_CPU_CYCLES", &bandit_ctrs[i]);
+        for (int j = 0; j < n_bandit_events; j++)
+            setup_ctr(bandit_events[j], &bandit_ctrs[i]);
+    }
+
+    bandit_ctrs_len = ctrs_len(&bandit_ctrs[0]);
+}
+
 static void
 setup_pirate() 
 {
@@ -653,7 +2357,14 @@ setup_pirate()
     pirate_pthread_conf = malloc(n_pirates*sizeof(pirate_pthread_conf_t));
     pirate_ctrs = malloc(n_pirates*sizeof(ctr_list_t));
     pirate_thread = malloc(n_pirates*sizeof(pthread_t));
-    pirate_state = malloc(n_pirates*sizeof(pirate_state_t));
+    EXPECT(posix_memalign((void **)&pirate_slot, CACHE_LINE_SIZE,
+                          n_pirates * sizeof(pirate_slot_t)) == 0);
+    memset(pirate_slot, 0, n_pirates * sizeof(pirate_slot_t));
+
+    /* Epoch 1 is the initial warm-up, run_epoch 0 makes the
+     * calibration and reference runs single passes */
+    pirate_sync.epoch.val = 1;
+    pirate_sync.pending = n_pirates;
 
     pirate_conf_t *p = &pirate_conf;
 
@@ -668,21 +2379,81 @@ setup_pirate()
     assert(p->way_size>=0);
 
 
-    if (p->loop_fix == 0) {
-        p->alloc_size = p->size;
-    } else {
-        p->alloc_size = (p->ways - 1 +
-            ((p->size % p->way_size) ? 1 : 0)) * MEM_HUGE_SIZE;
+    /* Way sized chunks start on huge page aligned addresses, so that
+     * they map to the same cache sets */
+    const int chunks = p->size / p->way_size + (p->size % p->way_size ? 1 : 0);
+    p->chunk_stride = ROUND_UP(p->way_size, MEM_HUGE_SIZE);
+    p->alloc_size = p->loop_fix ? chunks * p->chunk_stride : p->size;
+    if (p->kernel == PIRATE_KERNEL_COLOR)
+        p->alloc_size = MAX(p->alloc_size, COLOR_SLACK * p->size);
+
+    EXPECT_ERRNO(mem_huge_alloc(&pirate_mem, p->alloc_size, huge_pages) == 0);
+    p->data = pirate_mem.addr;
+    EXPECT(pirate_mem.page_size);
+
+    if (pirate_mem.page_size < MEM_HUGE_SIZE) {
+        fprintf(stderr, "Warning: The pirate data set is backed by %zu kB "
+                "pages, ways may not map to the same cache sets.\n",
+                pirate_mem.page_size >> 10);
+        /* Page alignment is all that the chunks can get */
+        p->chunk_stride = ROUND_UP(p->way_size, pirate_mem.page_size);
+        if (p->kernel != PIRATE_KERNEL_COLOR)
+            p->alloc_size = p->loop_fix ? chunks * p->chunk_stride : p->size;
     }
 
-    EXPECT_ERRNO(p->data = mem_huge_alloc(p->alloc_size));
+    if (p->kernel == PIRATE_KERNEL_RANDOM)
+        build_random_chains(p);
+    else if (p->kernel == PIRATE_KERNEL_COLOR)
+        build_color_list(p);
+
+    if (p->kernel == PIRATE_KERNEL_MLP || p->kernel == PIRATE_KERNEL_AUTO) {
+        EXPECT(pirate_variants_init(p->stride) > 0);
+        if (p->kernel == PIRATE_KERNEL_MLP)
+            EXPECT((p->variant = pirate_variant_find(p->streams)) != -1);
+    }
+
+    heat_drop = (heat_drop_ways ? heat_drop_ways : MAX(p->ways / 2, 1)) *
+        p->way_size;
+
+    if (!p->no_sweep) {
+        /* Sub-way sizes of the adaptive schedule are multiples of a
+         * line per pirate */
+        const int unit = p->stride * n_pirates;
+        /* With --domains, every domain sweeps every n_domains:th size */
+        const schedule_conf_t sc = {
+            .first = domain * p->way_size,
+            .step = n_domains * p->way_size,
+            .last = p->size - p->way_size,
+            .list = schedule_list,
+            .list_len = schedule_list_len,
+            .seed = schedule_seed,
+            .min_step = MAX(p->way_size / SWEEP_REFINE / unit, 1) * unit,
+            .ci_width = ci_width,
+            .min_samples = SWEEP_MIN_SAMPLES,
+        };
+
+        if (sc.first > sc.last) {
+            fprintf(stderr, "Too many domains for %d ways.\n", p->ways);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < schedule_list_len; i++) {
+            if (schedule_list[i] > sc.last) {
+                fprintf(stderr, "Pirate size %u in the schedule is larger "
+                        "than the largest size, %u.\n",
+                        schedule_list[i], sc.last);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        p->sweep_start = sc.first;
+        p->sweep_step = sc.step;
+        p->current_size = schedule_init(&schedule, schedule_id, &sc);
+    }
 
     for(int i = 0; i < n_pirates; i++){
         pirate_pthread_conf[i].cpu = pirate_cpus[i];
         pirate_pthread_conf[i].pirate_number = i;
 
-        pirate_state[i]=PIRATE_NEXT_SIZE;
-
         pirate_ctrs[i].head=NULL;
         pirate_ctrs[i].tail=NULL;
 
@@ -692,13 +2463,209 @@ setup_pirate()
         
         for(int j = 0; j < no_extra_p_ctrs; j++)
             setup_ctr(extra_p_ctrs[j], &pirate_ctrs[i]);
-        
+
+        /* The fetch ratio that the governor follows */
+        if (gov_threshold) {
+            setup_ctr("PERF_COUNT_HW_CACHE_REFERENCES", &pirate_ctrs[i]);
+            setup_ctr("PERF_COUNT_HW_CACHE_MISSES", &pirate_ctrs[i]);
+        }
     }
 
     EXPECT((pirate_ctrs_len = ctrs_len(&pirate_ctrs[0])) != 0 );
+    if (gov_threshold) {
+        gov_init(&governor, gov_threshold);
+        gov_access_idx = pirate_ctrs_len - 2;
+        gov_miss_idx = pirate_ctrs_len - 1;
+    }
+
+    setup_bandits();
+    setup_sample_buffer();
+}
+
+
+/*
+ * Use one pirate in every other core that shares the LLC with the
+ * target. Falls back to a CPU next to the target if the topology
+ * isn't known.
+ */
+static void
+pick_pirate_cpus()
+{
+    cpu_set_t allowed;
+
+    EXPECT_ERRNO(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    EXPECT(pirate_cpus = malloc(CPU_SETSIZE * sizeof(int)));
+    n_pirates = topo_pick_pirates(target_cpu, &allowed, pirate_cpus,
+                                  CPU_SETSIZE);
+
+    if (n_pirates <= 0) {
+        fprintf(stderr, "Warning: No topology information for a pirate "
+                "CPU, use --pirate-cpu.\n");
+        n_pirates = 1;
+        pirate_cpus[0] = (target_cpu == 0 ? 1 : target_cpu -1);
+    }
+}
+
+/* Pirates must share the LLC with the target, but not its core */
+static void
+check_pirate_cpus(struct argp_state *state)
+{
+    for (int i = 0; i < n_pirates; i++) {
+        switch (topo_check_pirate(target_cpu, pirate_cpus[i])) {
+        case -1:
+            fprintf(stderr, "Warning: Can't check pirate CPUs, no topology "
+                    "information for CPU %d.\n", target_cpu);
+            return;
+        case TOPO_PIRATE_OTHER_LLC:
+            argp_failure(state, EXIT_FAILURE, 0,
+                         "Pirate CPU %d doesn't share the last level cache "
+                         "with target CPU %d.\n", pirate_cpus[i], target_cpu);
+            break;
+        case TOPO_PIRATE_SIBLING:
+            argp_failure(state, EXIT_FAILURE, 0,
+                         "Pirate CPU %d is a hardware thread in the core of "
+                         "target CPU %d.\n", pirate_cpus[i], target_cpu);
+            break;
+        }
+    }
+}
+
+/*
+ * Find the LLC domains for --domains and a target CPU in each. The
+ * target CPU from -c is used in its own domain.
+ */
+static void
+setup_domains(struct argp_state *state)
+{
+    cpu_set_t allowed;
+    int found;
+
+    if (n_pirates)
+        argp_error(state, "--domains picks the pirate CPUs, "
+                   "--pirate-cpu can't be used with it\n");
+    if (pirate_conf.no_sweep)
+        argp_error(state, "--domains needs a sweep\n");
+    if (output_format != OUTPUT_PROTOBUF)
+        argp_error(state, "--domains needs --format=protobuf\n");
+    if (summary_name)
+        argp_error(state, "--summary can't be used with --domains\n");
+
+    EXPECT_ERRNO(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    EXPECT(domain_cpus = malloc(CPU_SETSIZE * sizeof(cpu_set_t)));
+    found = topo_llc_domains(&allowed, domain_cpus, CPU_SETSIZE);
+    if (found <= 0)
+        argp_failure(state, EXIT_FAILURE, 0,
+                     "No LLC topology information for --domains\n");
+
+    if (n_domains == -1)
+        n_domains = found;
+    else if (n_domains > found)
+        argp_failure(state, EXIT_FAILURE, 0,
+                     "Only %d LLC domains available\n", found);
+
+    EXPECT(domain_target = malloc(n_domains * sizeof(int)));
+    for (int d = 0; d < n_domains; d++) {
+        domain_target[d] = target_cpu;
+        if (!CPU_ISSET(target_cpu, &domain_cpus[d]))
+            for (int cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--)
+                if (CPU_ISSET(cpu, &domain_cpus[d]))
+                    domain_target[d] = cpu;
+    }
+
+    /* A single domain runs in this process, see run_domains() */
+    if (n_domains == 1) {
+        target_cpu = domain_target[0];
+        pick_pirate_cpus();
+    }
+}
+
+/*
+ * Run one perfpirate process per domain. The children return and run
+ * as usual, with their own target, pirates and output file. The
+ * parent waits for them, merges their output and exits.
+ */
+static void
+run_domains()
+{
+    char **files;
+    pid_t *pids;
+    int failed = 0;
+
+    EXPECT(files = malloc(n_domains * sizeof(char *)));
+    EXPECT(pids = malloc(n_domains * sizeof(pid_t)));
+    for (int d = 0; d < n_domains; d++)
+        EXPECT(asprintf(&files[d], "%s.domain%d", pb_output_name, d) != -1);
+
+    fflush(stderr);
+    for (int d = 0; d < n_domains; d++) {
+        EXPECT_ERRNO((pids[d] = fork()) != -1);
+        if (pids[d] == 0) {
+            domain = d;
+            target_cpu = domain_target[d];
+            pb_output_name = files[d];
+            pick_pirate_cpus();
+
+            fprintf(stderr, "Domain %d: Target_cpu: %d Pirate_cpus:",
+                    domain, target_cpu);
+            for (int i = 0; i < n_pirates; i++)
+                fprintf(stderr, " %d", pirate_cpus[i]);
+            fprintf(stderr, "\n");
+            return;
+        }
+    }
+
+    for (int d = 0; d < n_domains; d++) {
+        int status;
+
+        EXPECT_ERRNO(waitpid(pids[d], &status, 0) == pids[d]);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Domain %d failed.\n", d);
+            failed = 1;
+        }
+    }
+
+    if (failed) {
+        fprintf(stderr, "Not merging, the output of each domain is in "
+                "%s.domain*\n", pb_output_name);
+        exit(EXIT_FAILURE);
+    }
 
+    pb_merge_domains(pb_output_name, files, n_domains);
+    for (int d = 0; d < n_domains; d++)
+        EXPECT_ERRNO(unlink(files[d]) == 0);
+    exit(EXIT_SUCCESS);
 }
 
+/* NAME, random:SEED or list:SIZE,SIZE,... */
+static void
+parse_schedule(char *arg, struct argp_state *state)
+{
+    char *param = strchr(arg, ':');
+
+    if (param)
+        *param++ = '\0';
+    if (schedule_lookup(arg, &schedule_id) != 0)
+        argp_error(state, "Unknown schedule: %s\n", arg);
+
+    if (schedule_id == SCHEDULE_RANDOM && param) {
+        schedule_seed = perf_argp_parse_long("SEED", param, state);
+    } else if (schedule_id == SCHEDULE_LIST) {
+        char *size;
+
+        if (!param)
+            argp_error(state, "The list schedule needs a list of sizes\n");
+        while ((size = strsep(&param, ","))) {
+            const long val = perf_argp_parse_long("SIZE", size, state);
+
+            if (val < 0)
+                argp_error(state, "Pirate size must be positive\n");
+            EXPECT(schedule_list = realloc(schedule_list,
+                (schedule_list_len + 1) * sizeof(uint32_t)));
+            schedule_list[schedule_list_len++] = val;
+        }
+    } else if (param)
+        argp_error(state, "The %s schedule takes no parameters\n", arg);
+}
 
 /*** argument handling ************************************************/
 static error_t
@@ -717,18 +2684,29 @@ parse_opt (int key, char *arg, struct argp_state *state)
             argp_error(state, "CPU number must be positive\n");
         break;
 
-    case 'C':
-        if(n_pirates>=MAX_PIRATES) {
-            argp_error(state, "Too many pirates, limit is 5\n");
-            break;
-        }
-        int cpu = perf_argp_parse_long("CPU", arg, state);
-        
-        pirate_cpus[n_pirates] = cpu;
-        n_pirates++;
-        if (pirate_cpus[n_pirates] < 0)
+    case 'C': {
+        char *type = strchr(arg, ':');
+        int cpu;
+
+        if (type)
+            *type++ = '\0';
+        cpu = perf_argp_parse_long("CPU", arg, state);
+        if (cpu < 0)
             argp_error(state, "CPU number must be positive\n");
+
+        if (type && !strcmp(type, "bandit")) {
+            EXPECT(bandit_cpus = realloc(bandit_cpus,
+                                         (n_bandits + 1) * sizeof(int)));
+            bandit_cpus[n_bandits++] = cpu;
+        } else if (!type || !strcmp(type, "pirate")) {
+            EXPECT(pirate_cpus = realloc(pirate_cpus,
+                                         (n_pirates + 1) * sizeof(int)));
+            pirate_cpus[n_pirates] = cpu;
+            n_pirates++;
+        } else
+            argp_error(state, "Unknown thread type: %s\n", type);
         break;
+    }
 
     case 's':
         pirate_conf.current_size = perf_argp_parse_long("SIZE", arg, state);
@@ -778,6 +2756,204 @@ parse_opt (int key, char *arg, struct argp_state *state)
         pirate_conf.no_reference = 1;
         break;
 
+    case KEY_STATS:
+        print_stats = 1;
+        break;
+
+    case KEY_WRITER_SLOTS:
+        writer_slots = perf_argp_parse_long("N", arg, state);
+        if (writer_slots <= 0)
+            argp_error(state, "Number of writer slots must be positive\n");
+        break;
+
+    case KEY_WRITER_DROP:
+        writer_drop = 1;
+        break;
+
+    case KEY_PIRATE_KERNEL:
+        if (!strcmp(arg, "stride"))
+            pirate_conf.kernel = PIRATE_KERNEL_STRIDE;
+        else if (!strcmp(arg, "random"))
+            pirate_conf.kernel = PIRATE_KERNEL_RANDOM;
+        else if (!strcmp(arg, "mlp"))
+            pirate_conf.kernel = PIRATE_KERNEL_MLP;
+        else if (!strcmp(arg, "auto"))
+            pirate_conf.kernel = PIRATE_KERNEL_AUTO;
+        else if (!strcmp(arg, "color"))
+            pirate_conf.kernel = PIRATE_KERNEL_COLOR;
+        else
+            argp_error(state, "Unknown pirate kernel: %s\n", arg);
+        break;
+
+    case KEY_BANDIT_RATES: {
+        char *rate;
+
+        n_bandit_rates = 0;
+        while ((rate = strsep(&arg, ","))) {
+            long val;
+
+            if (!strcmp(rate, "max"))
+                val = BANDIT_RATE_MAX;
+            else if ((val = perf_argp_parse_long("RATE", rate, state)) < 0 ||
+                     val >= BANDIT_RATE_MAX)
+                argp_error(state, "Bandit rate must be 0 to %u MB/s or "
+                           "'max'\n", BANDIT_RATE_MAX - 1);
+            EXPECT(bandit_rates = realloc(bandit_rates,
+                (n_bandit_rates + 1) * sizeof(uint32_t)));
+            bandit_rates[n_bandit_rates++] = val;
+        }
+        break;
+    }
+
+    case KEY_BANDIT_SIZE: {
+        const long size = perf_argp_parse_long("SIZE", arg, state);
+
+        if (size <= 0)
+            argp_error(state, "Bandit size must be positive\n");
+        bandit_size = size;
+        break;
+    }
+
+    case KEY_BANDIT_EVENT:
+        if (n_bandit_events >= MAX_EXTRA_P_CTRS)
+            argp_error(state, "Too many bandit events: %s\n", arg);
+        bandit_events[n_bandit_events++] = arg;
+        break;
+
+    case KEY_GOVERNOR: {
+        char *end;
+
+        gov_threshold = strtod(arg, &end);
+        if (*end || gov_threshold <= 0 || gov_threshold >= 1)
+            argp_error(state, "Fetch ratio must be between 0 and 1\n");
+        break;
+    }
+
+    case KEY_SLICES:
+        n_slices = perf_argp_parse_long("N", arg, state);
+        if (n_slices < 1 || n_slices > SLICE_MAX)
+            argp_error(state, "Number of slices must be 1 to %d\n",
+                       SLICE_MAX);
+        break;
+
+    case KEY_HUGE_PAGES:
+        if (!strcmp(arg, "auto"))
+            huge_pages = MEM_PAGES_AUTO;
+        else if (!strcmp(arg, "1g"))
+            huge_pages = MEM_PAGES_1G;
+        else if (!strcmp(arg, "2m"))
+            huge_pages = MEM_PAGES_2M;
+        else if (!strcmp(arg, "thp"))
+            huge_pages = MEM_PAGES_THP;
+        else
+            argp_error(state, "Unknown huge page policy: %s\n", arg);
+        break;
+
+    case KEY_DOMAINS:
+        if (!strcmp(arg, "all"))
+            n_domains = -1;
+        else if ((n_domains = perf_argp_parse_long("N", arg, state)) < 1)
+            argp_error(state, "Number of domains must be positive\n");
+        break;
+
+    case KEY_SYSFS_ROOT:
+        topo_set_root(arg);
+        break;
+
+    case KEY_PIRATE_STREAMS:
+        pirate_conf.streams = perf_argp_parse_long("N", arg, state);
+        if (pirate_conf.streams != 1 && pirate_conf.streams != 2 &&
+            pirate_conf.streams != 4 && pirate_conf.streams != 8)
+            argp_error(state, "Number of streams must be 1, 2, 4 or 8\n");
+        break;
+
+    case KEY_PIRATE_RDPMC:
+        pirate_rdpmc = 1;
+        break;
+
+    case KEY_HEAT_CONVERGE:
+        heat_converge = 1;
+        break;
+
+    case KEY_HEAT_WINDOW:
+        heat_window_usec = perf_argp_parse_long("TIME", arg, state);
+        if (heat_window_usec <= 0)
+            argp_error(state, "Time number must be positive\n");
+        break;
+
+    case KEY_HEAT_MAX:
+        heat_max_usec = perf_argp_parse_long("TIME", arg, state);
+        if (heat_max_usec <= 0)
+            argp_error(state, "Time number must be positive\n");
+        break;
+
+    case KEY_METRIC:
+        EXPECT(metric_defs = realloc(metric_defs,
+                                     (n_metrics + 1) * sizeof(char *)));
+        metric_defs[n_metrics++] = arg;
+        break;
+
+    case KEY_SUMMARY:
+        summary_name = arg;
+        break;
+
+    case KEY_SUMMARY_INTERVAL:
+        summary_interval = perf_argp_parse_long("seconds", arg, state);
+        if (summary_interval < 0)
+            argp_error(state, "Interval must be positive\n");
+        break;
+
+    case KEY_NO_RAW:
+        raw_output = 0;
+        break;
+
+    case KEY_GROUP_SIZE:
+        group_size = perf_argp_parse_long("counters", arg, state);
+        if (group_size < 2)
+            argp_error(state, "A group needs at least two counters\n");
+        break;
+
+    case KEY_DISCARD:
+        discard_insns = perf_argp_parse_long("instructions", arg, state);
+        break;
+
+    case KEY_ADAPTIVE:
+        schedule_id = SCHEDULE_ADAPTIVE;
+        break;
+
+    case KEY_SCHEDULE:
+        parse_schedule(arg, state);
+        break;
+
+    case KEY_HEAT_DROP:
+        heat_drop_ways = perf_argp_parse_long("WAYS", arg, state);
+        if (heat_drop_ways <= 0)
+            argp_error(state, "Heat drop must be at least one way\n");
+        break;
+
+    case KEY_CI_WIDTH: {
+        char *end;
+
+        ci_width = strtod(arg, &end);
+        if (*end || ci_width <= 0)
+            argp_error(state, "Confidence interval width must be a "
+                       "positive number\n");
+        break;
+    }
+
+    case KEY_STOP_FREE:
+        stop_free = 1;
+        break;
+
+    case KEY_FORMAT:
+        if (!strcmp(arg, "protobuf"))
+            output_format = OUTPUT_PROTOBUF;
+        else if (!strcmp(arg, "columnar"))
+            output_format = OUTPUT_COLUMNAR;
+        else
+            argp_error(state, "Unknown output format: %s\n", arg);
+        break;
+
 
     case ARGP_KEY_ARG:
         if (!state->quoted)
@@ -790,10 +2966,20 @@ parse_opt (int key, char *arg, struct argp_state *state)
             exec_argc = exec_argc - state->quoted;
         }
 
-        if(n_pirates == 0){
-            n_pirates = 1;
-            pirate_cpus[0] = (target_cpu == 0 ? 1 : target_cpu -1);
-        }
+        if (schedule_id == SCHEDULE_ADAPTIVE && pirate_conf.no_sweep)
+            argp_error(state, "--adaptive can't be used with a fixed "
+                       "pirate size\n");
+        if ((schedule_id == SCHEDULE_ADAPTIVE ||
+             schedule_id == SCHEDULE_LIST) && n_domains != 1)
+            argp_error(state, "The %s schedule can't be used with "
+                       "--domains\n", schedule_name(schedule_id));
+
+        if (n_domains != 1)
+            setup_domains(state);
+        else if(n_pirates == 0)
+            pick_pirate_cpus();
+        else
+            check_pirate_cpus(state);
 
         fprintf(stderr, "Target_cpu: %d Pirate_cpus: ", target_cpu);
         for(int i = 0; i < n_pirates; i++){
@@ -811,11 +2997,74 @@ parse_opt (int key, char *arg, struct argp_state *state)
                      "Pirate on same CPU as target.\n");
         }
 
+        if (n_bandits) {
+            fprintf(stderr, "Bandit_cpus: ");
+            for (int i = 0; i < n_bandits; i++)
+                fprintf(stderr, " %d", bandit_cpus[i]);
+            fprintf(stderr, "\n");
+        }
+
+        for (int i = 0; i < n_bandits; i++) {
+            for (int j = 0; j < i; j++)
+                if (bandit_cpus[i] == bandit_cpus[j])
+                    argp_error(state, "Only one bandit per CPU\n");
+            for (int j = 0; j < n_pirates; j++)
+                if (bandit_cpus[i] == pirate_cpus[j])
+                    argp_error(state, "Bandit on same CPU as a pirate\n");
+            if (bandit_cpus[i] == target_cpu)
+                argp_error(state, "Bandit on same CPU as target\n");
+        }
+
+        if (!n_bandits && (n_bandit_rates || bandit_size || n_bandit_events))
+            argp_error(state, "The bandit options need a bandit, "
+                       "-C CPU:bandit\n");
+        if (n_bandits && n_domains != 1)
+            argp_error(state, "Bandits can't be used with --domains\n");
+        if (n_bandit_rates > 1) {
+            if (pirate_conf.no_sweep)
+                argp_error(state, "Several bandit rates need a pirate "
+                           "sweep\n");
+            if (schedule_id == SCHEDULE_ADAPTIVE)
+                argp_error(state, "Several bandit rates can't be used "
+                           "with --adaptive\n");
+        }
+
         if (!exec_argv)
             argp_error(state,
                        "No target command specified.\n");
 
+        if (!raw_output && !summary_name)
+            argp_error(state, "--no-raw needs --summary\n");
+
         target_ctrs_len = ctrs_len(&perf_ctrs);
+        target_group_len = target_ctrs_len + (discard_insns ? 1 : 0);
+
+        if (group_size && target_ctrs_len > group_size) {
+            if (pirate_conf.no_sweep)
+                argp_error(state, "Multiplexed events need a pirate "
+                           "sweep\n");
+            if (stop_free)
+                argp_error(state, "Multiplexed events can't be used with "
+                           "--stop-free\n");
+            if (discard_insns)
+                argp_error(state, "Multiplexed events can't be used with "
+                           "--discard\n");
+            setup_ctr_groups();
+        }
+
+        if (n_slices && pirate_conf.kernel != PIRATE_KERNEL_COLOR)
+            argp_error(state, "--slices needs --pirate-kernel=color\n");
+
+        if (discard_insns) {
+            if (pirate_conf.no_sweep)
+                argp_error(state, "--discard needs a pirate sweep\n");
+            if (perf_ctrs.head->attr.freq)
+                argp_error(state, "--discard needs a fixed sample "
+                           "period\n");
+            if (discard_insns >= perf_ctrs.head->attr.sample_period)
+                argp_error(state, "--discard must be shorter than the "
+                           "sample period\n");
+        }
 
         break;
 
@@ -841,10 +3090,41 @@ const char *argp_program_bug_address =
 
 static struct argp_option arg_options[] = {
     { "output", 'o', "FILE", 0, "Protobuf output file", 0 },
+    { "format", KEY_FORMAT, "FORMAT", 0,
+      "Output format, 'protobuf' (PIRATEv1, default) or 'columnar' "
+      "(PIRATEv2)", 0 },
+    { "metric", KEY_METRIC, "NAME=EXPR", 0,
+      "Store a metric computed from the counters, e.g. "
+      "'cpi=PERF_COUNT_HW_CPU_CYCLES/PERF_COUNT_HW_INSTRUCTIONS', with "
+      "every sample and size. Use pirate.EVENT for the pirate counters.",
+      0 },
+    { "summary", KEY_SUMMARY, "FILE", 0,
+      "Write the count, sum, mean, variance, min and max of every "
+      "counter at each pirate size to FILE", 0 },
+    { "summary-interval", KEY_SUMMARY_INTERVAL, "SECONDS", 0,
+      "Rewrite the --summary file this often, 0 for only at exit. "
+      "Default is 10.", 0 },
+    { "no-raw", KEY_NO_RAW, NULL, 0,
+      "Don't write the samples to the output file, only the --summary", 0 },
     { "target-cpu", 'c', "CPU", 0,
       "Pin target process to CPU. Default is 0.", 0 },
-    { "pirate-cpu", 'C', "CPU", 0,
-      "Pin pirate to CPU. Repeat this option for more pirates.", 0 },
+    { "pirate-cpu", 'C', "CPU[:TYPE]", 0,
+      "Pin pirate to CPU, or a bandwidth bandit with CPU:bandit. Repeat "
+      "this option for more pirates and bandits.", 0 },
+    { "bandit-rates", KEY_BANDIT_RATES, "RATE,...", 0,
+      "Rates in MB/s that each bandit writes memory at, 0 for idle or "
+      "'max'. The rates take turns, one sweep cycle each. Default is "
+      "'max'.", 0 },
+    { "bandit-size", KEY_BANDIT_SIZE, "SIZE", 0,
+      "Bytes that each bandit streams through. Default is 8 times the "
+      "LLC.", 0 },
+    { "bandit-event", KEY_BANDIT_EVENT, "EVENT", 0,
+      "Events to measure on the bandits", 1 },
+    { "domains", KEY_DOMAINS, "N", 0,
+      "Run a target and pirates in each of N LLC domains ('all' for "
+      "every domain), each sweeping every N:th pirate size", 0 },
+    { "sysfs-root", KEY_SYSFS_ROOT, "DIR", 0,
+      "Read the CPU and cache topology from DIR instead of /sys", 0 },
     { "pirate-size", 's', "SIZE", 0, "Pirate data set size.", 0 },
     { "target-event", 'e', "EVENT", 0, "Events to measure on target", 1},
     { "pirate-event", 'E', "EVENT", 0, "Events to measure on Pirate", 1},
@@ -855,6 +3135,61 @@ static struct argp_option arg_options[] = {
       "Use sample period N of first event", 2 },
     { "sample-freq", KEY_SAMPLE_FREQ, "N", 0, 
       "Use sample frequency N of first event", 2 },
+    { "schedule", KEY_SCHEDULE, "SCHEDULE", 0,
+      "Order of the pirate sizes: 'ascending' (default), 'descending', "
+      "'zigzag', 'random[:SEED]', 'list:SIZE,SIZE,...' or 'adaptive'", 2 },
+    { "heat-converge", KEY_HEAT_CONVERGE, NULL, 0,
+      "Heat the target until its miss rate or CPI is stable instead of "
+      "for a fixed time", 2 },
+    { "heat-window", KEY_HEAT_WINDOW, "TIME", 0,
+      "Window in microseconds that --heat-converge measures the target "
+      "over. Default is 1,000.", 2 },
+    { "heat-max", KEY_HEAT_MAX, "TIME", 0,
+      "Longest heating in microseconds with --heat-converge. Default is "
+      "100,000.", 2 },
+    { "group-size", KEY_GROUP_SIZE, "N", 0,
+      "Counters that fit in one target group, including the instruction "
+      "leader. More target events take turns, one sweep cycle each.", 1 },
+    { "discard", KEY_DISCARD, "INSNS", 0,
+      "Split every sample after a size change into a discarded prefix "
+      "of INSNS target instructions and the measured remainder", 2 },
+    { "heat-drop", KEY_HEAT_DROP, "WAYS", 0,
+      "Heat the target when the pirate shrinks by at least WAYS ways. "
+      "Default is half of the ways.", 2 },
+    { "adaptive", KEY_ADAPTIVE, NULL, 0,
+      "Same as --schedule=adaptive. Refine the sweep where the curve "
+      "changes and stop when every size has converged", 2 },
+    { "ci-width", KEY_CI_WIDTH, "W", 0,
+      "Relative half width of the 95% confidence interval that --adaptive "
+      "stops at. Default is 0.02.", 2 },
+    { "stop-free", KEY_STOP_FREE, NULL, 0,
+      "Drain samples from the perf sample buffer without stopping the "
+      "target", 2 },
+    { "pirate-kernel", KEY_PIRATE_KERNEL, "KERNEL", 0,
+      "Pirate access pattern, 'stride' (default), 'random', 'mlp', "
+      "'color' or 'auto'", 1 },
+    { "huge-pages", KEY_HUGE_PAGES, "POLICY", 0,
+      "Pages of the pirate data set, '1g' or '2m' hugetlb pages, 'thp' "
+      "(transparent huge pages) or 'auto' (default), which tries them "
+      "in that order", 1 },
+    { "slices", KEY_SLICES, "N", 0,
+      "Find the N LLC slices of the color kernel's lines with eviction "
+      "tests and balance the lines across them", 1 },
+    { "governor", KEY_GOVERNOR, "RATIO", 0,
+      "Slow the pirates down at each size as far as their fetch ratio "
+      "(LLC misses per LLC access) stays at most RATIO", 1 },
+    { "pirate-streams", KEY_PIRATE_STREAMS, "N", 0,
+      "Number of streams of the mlp kernel, 1, 2, 4 or 8. Default is 4.", 1 },
+    { "pirate-rdpmc", KEY_PIRATE_RDPMC, NULL, 0,
+      "Let the pirates read their own counters with rdpmc instead of "
+      "reading them from the sampler with read()", 2 },
+    { "stats", KEY_STATS, NULL, 0,
+      "Print timing statistics for the sample path on exit", 3 },
+    { "writer-slots", KEY_WRITER_SLOTS, "N", 0,
+      "Number of samples queued for the writer thread. Default is 4096.", 3 },
+    { "writer-drop", KEY_WRITER_DROP, NULL, 0,
+      "Drop samples when the writer queue is full instead of stalling "
+      "the target", 3 },
     { 0 }
 };
 
@@ -872,6 +3207,43 @@ static struct argp argp =
 };
 
 
+static void
+setup_stop_free()
+{
+    struct perf_event_attr *attr = &perf_ctrs.head->attr;
+
+    attr->sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_READ;
+    attr->wakeup_events = 1;
+#ifdef PERF_ATTR_SIZE_VER5
+    /* Use the same clock as lat_now() for the record time stamps */
+    attr->use_clockid = 1;
+    attr->clockid = CLOCK_MONOTONIC;
+#else
+    fprintf(stderr, "Warning: perf_event_attr has no clockid, sample "
+            "times are not comparable with the size change times.\n");
+#endif
+}
+
+static void
+setup_metrics()
+{
+    char err[256];
+
+    if (!n_metrics)
+        return;
+
+    EXPECT(metrics = calloc(n_metrics, sizeof(metric_t)));
+    for (int i = 0; i < n_metrics; i++) {
+        if (metric_compile(&metrics[i], metric_defs[i], &perf_ctrs,
+                           &pirate_ctrs[0], err, sizeof(err))) {
+            fprintf(stderr, "Invalid metric '%s': %s\n",
+                    metric_defs[i], err);
+            exit(EXIT_FAILURE);
+        }
+    }
+    pb_set_metrics(metrics, n_metrics);
+}
+
 static void
 initialize(int argc, char **argv){
 
@@ -896,13 +3268,57 @@ initialize(int argc, char **argv){
             0,
             NULL);
 
-    setup_pirate();
+    if (n_domains > 1)
+        run_domains();
 
+    if (stop_free)
+        setup_stop_free();
+
+    setup_pirate();
+    setup_metrics();
+
+    pb_set_writer(writer_slots, writer_drop);
+    pb_set_format(output_format);
+    if (n_bandits)
+        pb_set_bandits(bandit_cpus, n_bandits, &bandit_ctrs[0], bandit_size,
+                       bandit_rates, n_bandit_rates);
+    if (summary_name)
+        pb_set_summary(summary_name, summary_interval, raw_output);
     pb_initialize(target_cpu, pirate_conf.no_reference, 
         perf_ctrs.head->attr.sample_period, &perf_ctrs, 
         &pirate_conf, pirate_pthread_conf, n_pirates, 
         pirate_ctrs, pb_output_name, exec_argv, exec_argc);
 
+    pb_write_pages(pirate_mem.method, pirate_mem.page_size);
+    if (pirate_conf.kernel == PIRATE_KERNEL_COLOR)
+        pb_write_color(color_physical);
+    if (n_slices)
+        pb_write_slices(n_slices, slice_tested_sets, slice_occ, slice_occ_len);
+
+    pb_write_heat(heat_converge, heat_converge ? heat_max_usec : t_heat_usek,
+                  heat_converge ? heat_window_usec : 0);
+
+    if (discard_insns)
+        pb_write_discard(discard_insns);
+
+    for (int i = 0; i < n_ctr_groups; i++)
+        pb_write_ctr_group(i, ctr_groups[i].idx, ctr_groups[i].len);
+
+    if (!pirate_conf.no_sweep)
+        pb_write_schedule(schedule_name(schedule_id), schedule_seed,
+                          schedule_list, schedule_list_len, heat_drop);
+
+    if (schedule_id == SCHEDULE_ADAPTIVE) {
+        char metric[256];
+
+        snprintf(metric, sizeof(metric), "%s/%s",
+                 target_ctrs_len > 1 && !n_ctr_groups ?
+                 perf_ctrs.tail->event_name :
+                 "time_running", perf_ctrs.head->event_name);
+        pb_write_adaptive(ci_width, SWEEP_MIN_SAMPLES, schedule.sweep.min_step,
+                          metric);
+    }
+
 }
 
 int
@@ -34,9 +34,13 @@
  
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+/* Round x upwards to a multiple of m */
+#define ROUND_UP(x, m) (((x) + (m) - 1) / (m) * (m))
 
 #ifndef MEM_HUGE_SIZE
-/* The size of a huge page */
+/* The size of a huge page, and the largest alignment of the way
+ * sized chunks with loop_fix */
 #define MEM_HUGE_SIZE (2*(1<<20))
 #endif
 
@@ -44,16 +48,84 @@
 
 #define NO_PID -1
 
-#define MAX_PIRATES 10
 #define MAX_EXTRA_P_CTRS 10
 
 #define DEFAULT_SAMPLE_PERIOD 10000000
 
+/* Seed for the random pirate kernel's access order */
+#define RANDOM_KERNEL_SEED 1
+
+/* The color kernel picks its lines from a data set this many times
+ * larger than the cache */
+#define COLOR_SLACK 2
+
+/* --slices: Set indexes whose lines are split into slices with
+ * eviction tests, and votes per eviction test */
+#define SLICE_CAL_SETS 8
+#define SLICE_TEST_REPS 5
+
+/* Bandwidth bandits stream through this many times the LLC size by
+ * default, BANDIT_CHUNK bytes between two rate checks, and don't
+ * catch up on more than BANDIT_MAX_LAG_NSEC of lost time */
+#define BANDIT_LLC_SCALE 8
+#define BANDIT_CHUNK (64 << 10)
+#define BANDIT_MAX_LAG_NSEC 1000000ULL
+/* Bandit rate in MB/s without throttling */
+#define BANDIT_RATE_MAX UINT32_MAX
+
+/* --governor: pirate_delay() loops timed to calibrate it, and
+ * timings of which the fastest is used */
+#define GOVERNOR_CAL_LOOPS (1 << 24)
+#define GOVERNOR_CAL_RUNS 5
+
+/* Time to run each kernel variant when autotuning, in ns */
+#define CALIBRATE_NSEC 20000000ULL
+
+#define CACHE_LINE_SIZE 64
+
+/* Convergence heating: The target has heated when its metric changes
+ * by at most HEAT_TOLERANCE between HEAT_STABLE_WINDOWS windows */
+#define HEAT_DEFAULT_WINDOW_USEC 1000
+#define HEAT_DEFAULT_MAX_USEC 100000
+#define HEAT_TOLERANCE 0.05
+#define HEAT_STABLE_WINDOWS 3
+
+#define DEFAULT_WRITER_SLOTS 4096
+#define WRITER_IDLE_USEC 100
+
+/* Size of the target sample buffer in stop-free mode, in pages */
+#define STOP_FREE_RING_PAGES 64
+/* Seconds between writes of the --summary file */
+#define SUMMARY_DEFAULT_INTERVAL_SEC 10
+
+/* The --discard trigger records one sample per period */
+#define DISCARD_RING_PAGES 1
+
 typedef enum {
-    PIRATE_RUNNING,
-    PIRATE_NEXT_SIZE,
-    PIRATE_FINISHED,
-} pirate_state_t;
+    /* Constant stride over the data set */
+    PIRATE_KERNEL_STRIDE,
+    /* Pointer chasing in random order within each way sized chunk */
+    PIRATE_KERNEL_RANDOM,
+    /* Several streams in lock step with vector loads */
+    PIRATE_KERNEL_MLP,
+    /* Pick stride or the fastest mlp variant at startup */
+    PIRATE_KERNEL_AUTO,
+    /* Equal number of lines in every cache set, by physical address */
+    PIRATE_KERNEL_COLOR,
+} pirate_kernel_t;
+
+static inline const char *
+pirate_kernel_name(pirate_kernel_t kernel)
+{
+    switch (kernel) {
+    case PIRATE_KERNEL_STRIDE: return "stride";
+    case PIRATE_KERNEL_RANDOM: return "random";
+    case PIRATE_KERNEL_MLP: return "mlp";
+    case PIRATE_KERNEL_AUTO: return "auto";
+    case PIRATE_KERNEL_COLOR: return "color";
+    }
+    return "unknown";
+}
 
 typedef struct {
     void *data;
@@ -64,9 +136,24 @@ typedef struct {
     int stride;
     int way_size;
     int loop_fix;
+    /* Distance between the way sized chunks with loop_fix, depends on
+     * the page size of the data set */
+    int chunk_stride;
+    /* Color kernel: offset of every line, way level by way level,
+     * n_sets lines per level, see build_color_list() */
+    uint32_t *color_list;
+    int n_sets;
     int l2_size;
     int no_sweep;
     int no_reference;
+    pirate_kernel_t kernel;
+    /* Number of streams of the mlp kernel */
+    int streams;
+    /* Variant of the mlp kernel, see pirate_variant() */
+    int variant;
+    /* First size and distance between sizes of the sweep */
+    int sweep_start;
+    int sweep_step;
 } pirate_conf_t;
 
 typedef struct {
@@ -74,6 +161,13 @@ typedef struct {
     int pirate_number;
 } pirate_pthread_conf_t;
 
+/* Counter values published by a pirate thread. Protected by a
+ * sequence lock, seq is odd while the values are being updated. */
+typedef struct {
+    volatile uint64_t seq;
+    uint64_t val[];
+} pirate_snap_t;
+
 typedef enum {
     TARGET_WAIT_EXEC,
     TARGET_RUNNING,
@@ -84,8 +178,71 @@ enum {
     KEY_SAMPLE_PERIOD = -1,
     KEY_SAMPLE_FREQ = -2,
     KEY_NO_REFERENCE = -3,
+    KEY_STATS = -4,
+    KEY_WRITER_SLOTS = -5,
+    KEY_WRITER_DROP = -6,
+    KEY_FORMAT = -7,
+    KEY_STOP_FREE = -8,
+    KEY_PIRATE_RDPMC = -9,
+    KEY_PIRATE_KERNEL = -10,
+    KEY_PIRATE_STREAMS = -11,
+    KEY_SYSFS_ROOT = -12,
+    KEY_DOMAINS = -13,
+    KEY_ADAPTIVE = -14,
+    KEY_CI_WIDTH = -15,
+    KEY_SCHEDULE = -16,
+    KEY_HEAT_DROP = -17,
+    KEY_HEAT_CONVERGE = -18,
+    KEY_HEAT_WINDOW = -19,
+    KEY_HEAT_MAX = -20,
+    KEY_DISCARD = -21,
+    KEY_GROUP_SIZE = -22,
+    KEY_SUMMARY = -23,
+    KEY_SUMMARY_INTERVAL = -24,
+    KEY_NO_RAW = -25,
+    KEY_METRIC = -26,
+    KEY_HUGE_PAGES = -27,
+    KEY_SLICES = -28,
+    KEY_BANDIT_RATES = -29,
+    KEY_BANDIT_SIZE = -30,
+    KEY_BANDIT_EVENT = -31,
+    KEY_GOVERNOR = -32,
 };
 
+typedef enum {
+    OUTPUT_PROTOBUF,
+    OUTPUT_COLUMNAR,
+} output_format_t;
+
+/* Describes where in the sweep a sample was taken */
+typedef struct {
+    uint32_t t_size;
+    uint32_t p_size;
+    uint32_t cycle;
+    /* schedule_id_t of the schedule that picked the size */
+    uint32_t schedule;
+    /* Stop-free mode only, CLOCK_MONOTONIC nanoseconds */
+    uint64_t time;
+    uint64_t size_time;
+    /* Duration of the heating before the sample, 0 if none, ns */
+    uint64_t heat_time;
+    /* Part of a period split by --discard, a sample_phase_t */
+    uint32_t phase;
+    /* Target counter group, see --group-size */
+    uint32_t group;
+    /* Rate of the bandwidth bandits, MB/s */
+    uint32_t bandit_rate;
+    /* Delay after every pirate line, ns, see --governor */
+    uint32_t pirate_delay;
+} sample_info_t;
+
+/* Must match the Phase enum in perf_pb.proto */
+typedef enum {
+    PHASE_WHOLE = 0,
+    PHASE_DISCARD,
+    PHASE_MEASURED,
+} sample_phase_t;
+
 typedef struct {
     uint64_t nr;
     uint64_t time_enabled;
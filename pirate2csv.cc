@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Native version of python/pirate2csv.py for PIRATEv1 logs. The
+ * output is identical to the Python script's, the dumps are decoded
+ * and summed on several threads.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <argp.h>
+
+#include "expect.h"
+#include "pirate_log.h"
+
+enum {
+    KEY_FS = -1,
+    KEY_NO_HEADER = -2,
+    KEY_NO_AGGREGATE = -3,
+    KEY_PHASE = -4,
+};
+
+enum {
+    PHASE_ALL = 0,
+    PHASE_ONLY_DISCARD,
+    PHASE_ONLY_MEASURED,
+};
+
+static const char *log_name = NULL;
+static const char *fs = " ";
+static int print_header = 1;
+static int aggregate = 1;
+static int phase_filter = PHASE_ALL;
+static int n_threads = 0;
+
+/* Sum of all dumps at one target size and bandit rate */
+typedef struct {
+	vector<uint64_t> target;
+	vector<vector<uint64_t> > pirates;
+	/* Counters of each bandit followed by the bytes it wrote */
+	vector<vector<uint64_t> > bandits;
+	/* Instructions counted by each multiplexed group */
+	map<uint32_t, uint64_t> leaders;
+} size_sum_t;
+
+/* Target size and bandit rate */
+typedef pair<uint32_t, uint32_t> size_key_t;
+typedef map<size_key_t, size_sum_t> size_map_t;
+
+typedef struct {
+	/* Per thread slot: sums (aggregate) or formatted rows */
+	vector<size_map_t> sums;
+	vector<string> rows;
+} csv_state_t;
+
+static void
+add_ctrs(vector<uint64_t> &sum, const PerfCtrSample &sample)
+{
+	if (sum.empty()) {
+		sum.assign(sample.ctr().begin(), sample.ctr().end());
+		return;
+	}
+	for (size_t i = 0; i < sum.size() && i < (size_t)sample.ctr_size(); i++)
+		sum[i] += sample.ctr(i);
+}
+
+static void
+add_samples(vector<vector<uint64_t> > &sums,
+	    const google::protobuf::RepeatedPtrField<PerfCtrSample> &samples)
+{
+	if (sums.empty())
+		sums.resize(samples.size());
+	for (size_t i = 0; i < sums.size() && i < (size_t)samples.size(); i++)
+		add_ctrs(sums[i], samples.Get(i));
+}
+
+static void
+add_sums(vector<vector<uint64_t> > &dst, const vector<vector<uint64_t> > &src)
+{
+	for (size_t p = 0; p < dst.size() && p < src.size(); p++) {
+		for (size_t i = 0; i < dst[p].size() && i < src[p].size(); i++)
+			dst[p][i] += src[p][i];
+	}
+}
+
+static void
+size_sum_add(size_sum_t &dst, const size_sum_t &src)
+{
+	if (dst.target.empty()) {
+		dst = src;
+		return;
+	}
+	for (size_t i = 0; i < dst.target.size() && i < src.target.size(); i++)
+		dst.target[i] += src.target[i];
+	add_sums(dst.pirates, src.pirates);
+	add_sums(dst.bandits, src.bandits);
+	for (map<uint32_t, uint64_t>::const_iterator it = src.leaders.begin();
+	     it != src.leaders.end(); ++it)
+		dst.leaders[it->first] += it->second;
+}
+
+static void
+append_ctrs(string &out, const vector<uint64_t> &ctrs)
+{
+	char buf[32];
+
+	for (size_t i = 0; i < ctrs.size(); i++) {
+		snprintf(buf, sizeof(buf), "%" PRIu64, ctrs[i]);
+		out += fs;
+		out += buf;
+	}
+}
+
+/* The bandit rate and counters are only printed if there are bandits */
+static void
+append_row(string &out, const size_key_t &key, const vector<uint64_t> &target,
+	   const vector<vector<uint64_t> > &pirates,
+	   const vector<vector<uint64_t> > &bandits)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%" PRIu32, key.first);
+	out += buf;
+	append_ctrs(out, target);
+	for (size_t p = 0; p < pirates.size(); p++)
+		append_ctrs(out, pirates[p]);
+	if (!bandits.empty()) {
+		snprintf(buf, sizeof(buf), "%" PRIu32, key.second);
+		out += fs;
+		out += buf;
+	}
+	for (size_t b = 0; b < bandits.size(); b++)
+		append_ctrs(out, bandits[b]);
+	out += "\n";
+}
+
+static vector<vector<uint64_t> >
+sample_ctrs(const google::protobuf::RepeatedPtrField<PerfCtrSample> &samples)
+{
+	vector<vector<uint64_t> > ctrs;
+
+	for (int i = 0; i < samples.size(); i++)
+		ctrs.push_back(vector<uint64_t>(samples.Get(i).ctr().begin(),
+						samples.Get(i).ctr().end()));
+	return ctrs;
+}
+
+static bool
+phase_selected(const PerfCtrDump &dump)
+{
+	switch (phase_filter) {
+	case PHASE_ONLY_DISCARD:
+		return dump.phase() == DISCARD;
+	case PHASE_ONLY_MEASURED:
+		return dump.phase() != DISCARD;
+	default:
+		return true;
+	}
+}
+
+static void
+csv_decode(const pirate_log_t *log, size_t chunk, int slot,
+	   size_t begin, size_t end, void *arg)
+{
+	csv_state_t *state = (csv_state_t *)arg;
+	size_map_t &sums = state->sums[slot];
+	string &rows = state->rows[slot];
+	PerfCtrDump dump;
+
+	rows.clear();
+	for (size_t i = begin; i < end; i++) {
+		EXPECT(plog_dump(log, i, &dump));
+		if (!phase_selected(dump))
+			continue;
+
+		const PerfCtrSample &t_sample = dump.t_sample();
+		const size_key_t key(t_sample.size(), dump.bandit_rate());
+		if (aggregate) {
+			size_sum_t &sum = sums[key];
+			add_ctrs(sum.target, t_sample);
+			add_samples(sum.pirates, dump.p_sample());
+			add_samples(sum.bandits, dump.b_sample());
+			if (t_sample.ctr_size())
+				sum.leaders[dump.group()] += t_sample.ctr(0);
+		} else {
+			vector<uint64_t> target(t_sample.ctr().begin(),
+						t_sample.ctr().end());
+			append_row(rows, key, target, sample_ctrs(dump.p_sample()),
+				   sample_ctrs(dump.b_sample()));
+		}
+	}
+}
+
+static void
+csv_done(const pirate_log_t *log, size_t chunk, int slot,
+	 size_t begin, size_t end, void *arg)
+{
+	csv_state_t *state = (csv_state_t *)arg;
+	const string &rows = state->rows[slot];
+
+	fwrite(rows.data(), 1, rows.size(), stdout);
+}
+
+/* Scale every multiplexed event to all instructions at a size */
+static vector<uint64_t>
+target_counters(const size_sum_t &sum, const PerfHeader &header)
+{
+	const PerfHeader::TargetSetup &t_setup = header.t_setup();
+	vector<uint64_t> ctrs(sum.target);
+	unsigned __int128 total = 0;
+
+	if (!t_setup.group_size())
+		return ctrs;
+
+	for (map<uint32_t, uint64_t>::const_iterator it = sum.leaders.begin();
+	     it != sum.leaders.end(); ++it)
+		total += it->second;
+
+	for (int g = 0; g < t_setup.group_size(); g++) {
+		const PerfHeader::CtrGroup &group = t_setup.group(g);
+		map<uint32_t, uint64_t>::const_iterator it =
+			sum.leaders.find(group.id());
+		const uint64_t insns = it == sum.leaders.end() ? 0 : it->second;
+
+		for (int i = 1; i < group.ctr_size(); i++) {
+			const uint32_t c = group.ctr(i);
+			if (c >= ctrs.size())
+				continue;
+			ctrs[c] = insns ? (uint64_t)(ctrs[c] * total / insns) : 0;
+		}
+	}
+
+	return ctrs;
+}
+
+static string
+join_ctrs(const PerfCtrSample &sample)
+{
+	string out;
+	char buf[32];
+
+	for (int i = 0; i < sample.ctr_size(); i++) {
+		snprintf(buf, sizeof(buf), "%" PRIu64, sample.ctr(i));
+		if (i)
+			out += " ";
+		out += buf;
+	}
+	return out;
+}
+
+static string
+join_cpus(const google::protobuf::RepeatedField<uint32_t> &cpus)
+{
+	string out;
+	char buf[16];
+
+	for (int i = 0; i < cpus.size(); i++) {
+		snprintf(buf, sizeof(buf), "%" PRIu32, cpus.Get(i));
+		if (i)
+			out += ",";
+		out += buf;
+	}
+	return out;
+}
+
+static void
+write_header(const PerfHeader &header)
+{
+	const PerfHeader::TargetSetup &t_setup = header.t_setup();
+	const PerfHeader::PirateSetup &p_setup = header.p_setup();
+	int cur_field = 1;
+
+	printf("# %i: Target cache size\n", cur_field);
+	printf("# \n");
+	printf("# Target:\n");
+	printf("# \tCommand: %s\n", t_setup.command().c_str());
+	printf("# \tCPU: %" PRIu32 "\n", t_setup.cpu());
+	printf("# \tSample period: %" PRIu64 "\n", t_setup.sample_period());
+	printf("# \tCounters:\n");
+	cur_field++;
+
+	for (int i = 0; i < t_setup.ctr_size(); i++)
+		printf("# \t\t %i: %s\n", i + cur_field, t_setup.ctr(i).name().c_str());
+	cur_field += t_setup.ctr_size();
+
+	if (t_setup.group_size()) {
+		printf("# \tCounter groups (scaled to all instructions):\n");
+		for (int g = 0; g < t_setup.group_size(); g++) {
+			const PerfHeader::CtrGroup &group = t_setup.group(g);
+
+			printf("# \t\t %" PRIu32 ":", group.id());
+			for (int i = 0; i < group.ctr_size(); i++)
+				printf(" %s", t_setup.ctr(group.ctr(i)).name().c_str());
+			printf("\n");
+		}
+	}
+
+	printf("# Pirate:\n");
+	printf("# \tWays: %" PRIu32 "\n", p_setup.ways());
+	printf("# \tCache size: %" PRIu32 "\n", p_setup.cache_size());
+	printf("# \tWay size: %" PRIu32 "\n", p_setup.way_size());
+	printf("# \tStride: %" PRIu32 "\n", p_setup.stride());
+	printf("# \tCPU: %s\n", join_cpus(p_setup.cpu()).c_str());
+	printf("# \tKernel: %s\n", p_setup.variant().empty() ?
+	       p_setup.kernel().c_str() : p_setup.variant().c_str());
+
+	for (int i = 0; i < p_setup.calibration_size(); i++)
+		printf("# \t\t %s: %.0f lines/s\n",
+		       p_setup.calibration(i).kernel().c_str(),
+		       p_setup.calibration(i).access_rate());
+
+	printf("# \tCounters:\n");
+	for (int i = 0; i < p_setup.ctr_size(); i++)
+		printf("# \t\t %i: %s\n", i + cur_field, p_setup.ctr(i).name().c_str());
+	cur_field += p_setup.ctr_size();
+
+	printf("# \tReference size:\t%" PRIu32 "\n", header.reference().size());
+	printf("# \tReference:\t%s\n", join_ctrs(header.reference()).c_str());
+
+	if (header.has_b_setup()) {
+		const PerfHeader::BanditSetup &b_setup = header.b_setup();
+
+		/* The bandit fields follow the counters of every pirate */
+		cur_field += p_setup.ctr_size() * (p_setup.cpu_size() - 1);
+		printf("# Bandit:\n");
+		printf("# \tCPU: %s\n", join_cpus(b_setup.cpu()).c_str());
+		printf("# \tSize: %" PRIu64 "\n", b_setup.size());
+		printf("# \tRates: %s\n", join_cpus(b_setup.rate()).c_str());
+		printf("# \t\t %i: Bandit rate (MB/s)\n", cur_field);
+		printf("# \tCounters:\n");
+		cur_field++;
+
+		for (int b = 0; b < b_setup.cpu_size(); b++) {
+			for (int i = 0; i < b_setup.ctr_size(); i++)
+				printf("# \t\t %i: b%i:%s\n", cur_field++, b,
+				       b_setup.ctr(i).name().c_str());
+			printf("# \t\t %i: b%i:bytes\n", cur_field++, b);
+		}
+	}
+
+	if (header.has_adaptive())
+		printf("# Adaptive sweep:\tMetric: %s\tCI width: %g\tMin step: %" PRIu32 "\n",
+		       header.adaptive().metric().c_str(),
+		       header.adaptive().ci_width(),
+		       header.adaptive().min_step());
+
+	for (int i = 0; i < header.domain_size(); i++) {
+		const PerfHeader::Domain &dom = header.domain(i);
+
+		printf("# Domain %" PRIu32 ":\tTarget CPU: %" PRIu32
+		       "\tPirate CPUs: %s\tSizes: %" PRIu32 " + n * %" PRIu32 "\n",
+		       dom.domain(), dom.t_cpu(), join_cpus(dom.p_cpu()).c_str(),
+		       dom.sweep_start(), dom.sweep_step());
+	}
+
+	for (int i = 0; i < header.kernel_reference_size(); i++)
+		printf("# \tReference (%s kernel):\t%s\n",
+		       header.kernel_reference(i).kernel().c_str(),
+		       join_ctrs(header.kernel_reference(i).sample()).c_str());
+}
+
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+	char *end;
+
+	switch (key) {
+	case KEY_FS:
+		fs = arg;
+		break;
+
+	case KEY_NO_HEADER:
+		print_header = 0;
+		break;
+
+	case KEY_NO_AGGREGATE:
+		aggregate = 0;
+		break;
+
+	case KEY_PHASE:
+		if (!strcmp(arg, "all"))
+			phase_filter = PHASE_ALL;
+		else if (!strcmp(arg, "discard"))
+			phase_filter = PHASE_ONLY_DISCARD;
+		else if (!strcmp(arg, "measured"))
+			phase_filter = PHASE_ONLY_MEASURED;
+		else
+			argp_error(state, "Unknown phase: %s\n", arg);
+		break;
+
+	case 'j':
+		n_threads = strtol(arg, &end, 0);
+		if (*end != '\0' || n_threads < 1)
+			argp_error(state, "Number of threads must be positive\n");
+		break;
+
+	case ARGP_KEY_ARG:
+		if (log_name)
+			argp_usage(state);
+		log_name = arg;
+		break;
+
+	case ARGP_KEY_END:
+		if (!log_name)
+			argp_usage(state);
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp_option arg_options[] = {
+	{ "fs", KEY_FS, "FS", 0, "Output field separator", 0 },
+	{ "no-header", KEY_NO_HEADER, NULL, 0,
+	  "Don't include CSV header with field descriptions", 0 },
+	{ "no-aggregate", KEY_NO_AGGREGATE, NULL, 0,
+	  "Don't sum counters", 0 },
+	{ "phase", KEY_PHASE, "PHASE", 0,
+	  "Only use this part of samples split by --discard "
+	  "(all, discard, measured)", 0 },
+	{ "threads", 'j', "N", 0,
+	  "Decode on N threads (default: number of CPUs)", 0 },
+	{ 0 }
+};
+
+static struct argp argp = {
+	arg_options, parse_opt, "LOG",
+	"Dump the contents of a pirate data file", NULL, NULL, NULL
+};
+
+int
+main(int argc, char **argv)
+{
+	pirate_log_t log;
+	csv_state_t state;
+	string err;
+
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+	argp_parse(&argp, argc, argv, 0, 0, NULL);
+	if (!n_threads)
+		n_threads = plog_default_threads();
+
+	if (plog_open(&log, log_name, &err)) {
+		fprintf(stderr, "Failed to read pirate log: %s\n", err.c_str());
+		exit(2);
+	}
+
+	if (print_header)
+		write_header(log.header);
+
+	state.sums.resize(n_threads);
+	state.rows.resize(n_threads);
+	plog_parallel(&log, n_threads, &csv_decode,
+		      aggregate ? NULL : &csv_done, &state);
+
+	if (!log.error.empty()) {
+		fprintf(stderr, "Failed to read pirate log: %s\n", log.error.c_str());
+		exit(2);
+	}
+
+	if (aggregate) {
+		size_map_t &sums = state.sums[0];
+		string rows;
+
+		for (int t = 1; t < n_threads; t++) {
+			for (size_map_t::iterator it = state.sums[t].begin();
+			     it != state.sums[t].end(); ++it)
+				size_sum_add(sums[it->first], it->second);
+		}
+
+		for (size_map_t::iterator it = sums.begin(); it != sums.end(); ++it)
+			append_row(rows, it->first,
+				   target_counters(it->second, log.header),
+				   it->second.pirates, it->second.bandits);
+		fwrite(rows.data(), 1, rows.size(), stdout);
+	}
+
+	plog_close(&log);
+	return 0;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Native version of python/pirate_dump.py for PIRATEv1 logs. Prints
+ * the header and every dump in protobuf text format, the dumps are
+ * formatted on several threads.
+ */
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <argp.h>
+
+#include <google/protobuf/text_format.h>
+
+#include "expect.h"
+#include "pirate_log.h"
+
+using google::protobuf::TextFormat;
+
+static const char *log_name = NULL;
+static int n_threads = 0;
+static TextFormat::Printer printer;
+
+/*
+ * Format a double like str() in Python 2, which pirate_dump.py prints
+ * the messages with: %.12g, but integral values get a ".0" and switch
+ * to an exponent one digit earlier. DebugString() would print the
+ * shortest round trip format instead.
+ */
+static void
+py_float_str(double val, char *buf, size_t len)
+{
+	char *e, *end;
+
+	if (isnan(val)) {
+		snprintf(buf, len, "nan");
+		return;
+	}
+	if (isinf(val)) {
+		snprintf(buf, len, val < 0 ? "-inf" : "inf");
+		return;
+	}
+
+	snprintf(buf, len, "%.12g", val);
+	if (strpbrk(buf, ".e"))
+		return;
+	if (strlen(buf) - (buf[0] == '-') < 12) {
+		strncat(buf, ".0", len - strlen(buf) - 1);
+		return;
+	}
+
+	/* Twelve integer digits, without the trailing zeros of the
+	 * mantissa like %g */
+	snprintf(buf, len, "%.11e", val);
+	e = strchr(buf, 'e');
+	end = e;
+	while (end[-1] == '0')
+		end--;
+	if (end[-1] == '.')
+		end--;
+	memmove(end, e, strlen(e) + 1);
+}
+
+class PyDoublePrinter : public TextFormat::FastFieldValuePrinter {
+public:
+	void PrintDouble(double val,
+			 TextFormat::BaseTextGenerator *generator) const
+	{
+		char buf[32];
+
+		py_float_str(val, buf, sizeof(buf));
+		generator->PrintString(buf);
+	}
+};
+
+static string
+format_message(const google::protobuf::Message &msg)
+{
+	string out;
+
+	EXPECT(printer.PrintToString(msg, &out));
+	return out;
+}
+
+static void
+dump_decode(const pirate_log_t *log, size_t chunk, int slot,
+	    size_t begin, size_t end, void *arg)
+{
+	string &out = ((vector<string> *)arg)->at(slot);
+	PerfCtrDump dump;
+
+	out.clear();
+	for (size_t i = begin; i < end; i++) {
+		EXPECT(plog_dump(log, i, &dump));
+		/* print in Python adds a newline after the message */
+		out += format_message(dump);
+		out += "\n";
+	}
+}
+
+static void
+dump_done(const pirate_log_t *log, size_t chunk, int slot,
+	  size_t begin, size_t end, void *arg)
+{
+	const string &out = ((vector<string> *)arg)->at(slot);
+
+	fwrite(out.data(), 1, out.size(), stdout);
+}
+
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+	char *end;
+
+	switch (key) {
+	case 'j':
+		n_threads = strtol(arg, &end, 0);
+		if (*end != '\0' || n_threads < 1)
+			argp_error(state, "Number of threads must be positive\n");
+		break;
+
+	case ARGP_KEY_ARG:
+		if (log_name)
+			argp_usage(state);
+		log_name = arg;
+		break;
+
+	case ARGP_KEY_END:
+		if (!log_name)
+			argp_usage(state);
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp_option arg_options[] = {
+	{ "threads", 'j', "N", 0,
+	  "Format on N threads (default: number of CPUs)", 0 },
+	{ 0 }
+};
+
+static struct argp argp = {
+	arg_options, parse_opt, "LOG",
+	"Dump the contents of a pirate data file", NULL, NULL, NULL
+};
+
+int
+main(int argc, char **argv)
+{
+	pirate_log_t log;
+	vector<string> out;
+	string err;
+
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+	argp_parse(&argp, argc, argv, 0, 0, NULL);
+	if (!n_threads)
+		n_threads = plog_default_threads();
+
+	if (plog_open(&log, log_name, &err)) {
+		fprintf(stderr, "Failed to read pirate log: %s\n", err.c_str());
+		exit(2);
+	}
+
+	printer.SetDefaultFieldValuePrinter(new PyDoublePrinter());
+	printf("%s\n", format_message(log.header).c_str());
+
+	out.resize(n_threads);
+	plog_parallel(&log, n_threads, &dump_decode, &dump_done, &out);
+	if (!log.error.empty()) {
+		fflush(stdout);
+		fprintf(stderr, "Failed to read pirate log: %s\n", log.error.c_str());
+		exit(2);
+	}
+
+	plog_close(&log);
+	return 0;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
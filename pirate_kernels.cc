@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <assert.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_VECTOR 1
+#endif
+
+#include "expect.h"
+#include "pirate_kernels.h"
+
+/*
+ * A touch function loads every stride:th byte of [base, base + len).
+ * The range is split into Streams equally sized parts which are
+ * walked in lock step, so that Streams independent misses can be in
+ * flight at a time and each stream looks like a separate, sequential
+ * stream to the hardware. Stride is the compile time stride, or 0 to
+ * use the run time stride. The lines are paced by pirate_pace(), one
+ * step of Streams lines at a time. Returns 0 if a new epoch ended the
+ * pass.
+ */
+typedef int (*touch_fn_t)(const char *base, long len, int stride,
+			  pirate_pace_t *pace);
+
+/* Keeps the loaded values alive */
+static volatile uint64_t sink;
+
+template <int Streams, int Stride>
+static int
+touch_scalar(const char *base, long len, int _stride, pirate_pace_t *pace)
+{
+	const long stride = Stride ? Stride : _stride;
+	const long part = len / Streams / stride * stride;
+	const volatile char *s = (const volatile char *)base;
+	char acc = 0;
+
+	for (long i = 0; i < part; i += stride) {
+#pragma GCC unroll 8
+		for (int k = 0; k < Streams; k++)
+			acc |= s[k * part + i];
+		if (!pirate_pace(pace, Streams))
+			return 0;
+	}
+	for (long i = Streams * part; i < len; i += stride) {
+		acc |= s[i];
+		if (!pirate_pace(pace, 1))
+			return 0;
+	}
+
+	sink = acc;
+	return 1;
+}
+
+#ifdef HAVE_X86_VECTOR
+/* Vector loads are aligned down so they never leave the cache line
+ * of the byte being touched */
+#define ALIGN_DOWN(p, a) ((const char *)((uintptr_t)(p) & ~(uintptr_t)((a) - 1)))
+
+template <int Streams, int Stride>
+static int
+touch_sse2(const char *base, long len, int _stride, pirate_pace_t *pace)
+{
+	const long stride = Stride ? Stride : _stride;
+	const long part = len / Streams / stride * stride;
+	__m128i acc = _mm_setzero_si128();
+
+	for (long i = 0; i < part; i += stride) {
+#pragma GCC unroll 8
+		for (int k = 0; k < Streams; k++)
+			acc = _mm_or_si128(acc, _mm_load_si128(
+				(const __m128i *)ALIGN_DOWN(base + k * part + i, 16)));
+		if (!pirate_pace(pace, Streams))
+			return 0;
+	}
+	for (long i = Streams * part; i < len; i += stride) {
+		acc = _mm_or_si128(acc, _mm_load_si128(
+			(const __m128i *)ALIGN_DOWN(base + i, 16)));
+		if (!pirate_pace(pace, 1))
+			return 0;
+	}
+
+	sink = _mm_cvtsi128_si32(acc);
+	return 1;
+}
+
+template <int Streams, int Stride>
+__attribute__((target("avx2")))
+static int
+touch_avx2(const char *base, long len, int _stride, pirate_pace_t *pace)
+{
+	const long stride = Stride ? Stride : _stride;
+	const long part = len / Streams / stride * stride;
+	__m256i acc = _mm256_setzero_si256();
+
+	for (long i = 0; i < part; i += stride) {
+#pragma GCC unroll 8
+		for (int k = 0; k < Streams; k++)
+			acc = _mm256_or_si256(acc, _mm256_load_si256(
+				(const __m256i *)ALIGN_DOWN(base + k * part + i, 32)));
+		if (!pirate_pace(pace, Streams))
+			return 0;
+	}
+	for (long i = Streams * part; i < len; i += stride) {
+		acc = _mm256_or_si256(acc, _mm256_load_si256(
+			(const __m256i *)ALIGN_DOWN(base + i, 32)));
+		if (!pirate_pace(pace, 1))
+			return 0;
+	}
+
+	sink = _mm256_extract_epi64(acc, 0);
+	return 1;
+}
+#endif
+
+typedef enum {
+	ISA_SCALAR,
+	ISA_SSE2,
+	ISA_AVX2,
+	ISA_COUNT,
+} isa_t;
+
+static const char *isa_names[ISA_COUNT] = { "scalar", "sse2", "avx2" };
+
+static int
+isa_supported(isa_t isa)
+{
+	switch (isa) {
+#ifdef HAVE_X86_VECTOR
+	case ISA_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	case ISA_SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+#endif
+	case ISA_SCALAR:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+template <int Streams, int Stride>
+static touch_fn_t
+touch_for_isa(isa_t isa)
+{
+	switch (isa) {
+#ifdef HAVE_X86_VECTOR
+	case ISA_AVX2: return &touch_avx2<Streams, Stride>;
+	case ISA_SSE2: return &touch_sse2<Streams, Stride>;
+#endif
+	default: return &touch_scalar<Streams, Stride>;
+	}
+}
+
+template <int Streams>
+static touch_fn_t
+touch_for_stride(isa_t isa, int stride)
+{
+	/* Specialize the common cache line sizes */
+	switch (stride) {
+	case 64: return touch_for_isa<Streams, 64>(isa);
+	case 128: return touch_for_isa<Streams, 128>(isa);
+	default: return touch_for_isa<Streams, 0>(isa);
+	}
+}
+
+static touch_fn_t
+select_touch(isa_t isa, int streams, int stride)
+{
+	switch (streams) {
+	case 1: return touch_for_stride<1>(isa, stride);
+	case 2: return touch_for_stride<2>(isa, stride);
+	case 4: return touch_for_stride<4>(isa, stride);
+	case 8: return touch_for_stride<8>(isa, stride);
+	}
+	EXPECT(!"Unsupported number of streams");
+	return NULL;
+}
+
+static pirate_variant_t variants[ISA_COUNT * 4];
+static touch_fn_t variant_touch[ISA_COUNT * 4];
+static int n_variants = 0;
+
+extern "C" int
+pirate_variants_init(int stride)
+{
+	n_variants = 0;
+	for (int isa = 0; isa < ISA_COUNT; isa++) {
+		if (!isa_supported((isa_t)isa))
+			continue;
+
+		for (int streams = 1; streams <= 8; streams *= 2) {
+			pirate_variant_t *v = &variants[n_variants];
+
+			v->isa = isa_names[isa];
+			v->streams = streams;
+			v->stride = (stride == 64 || stride == 128) ? stride : 0;
+			snprintf(v->name, sizeof(v->name), "mlp-%s-x%d", v->isa, streams);
+			variant_touch[n_variants] = select_touch((isa_t)isa, streams, stride);
+			n_variants++;
+		}
+	}
+
+	return n_variants;
+}
+
+extern "C" const pirate_variant_t *
+pirate_variant(int variant)
+{
+	assert(variant >= 0 && variant < n_variants);
+	return &variants[variant];
+}
+
+extern "C" int
+pirate_variant_find(int streams)
+{
+	/* The widest instruction set is added last */
+	for (int v = n_variants - 1; v >= 0; v--)
+		if (variants[v].streams == streams)
+			return v;
+	return -1;
+}
+
+extern "C" void
+pirate_loop_variant(const pirate_kernel_args_t *a, int variant)
+{
+	const touch_fn_t touch = variant_touch[variant];
+	char *data = a->data;
+	pirate_pace_t pace = { a->delay, a->epoch, a->publish, a->pirate_number,
+			       0, 0, 0 };
+
+	assert(variant >= 0 && variant < n_variants);
+
+	if (!a->loop_fix) {
+		/* Contiguous data set, same partitioning as pirate_loop() */
+		const int chunk = a->size / a->n_pirates;
+		const int start = a->pirate_number * chunk;
+
+		do {
+			pirate_pace_start(&pace);
+			if (!touch(data + start, chunk, a->stride, &pace))
+				return;
+			if (a->publish)
+				a->publish(a->pirate_number);
+		} while (*a->epoch == a->run_epoch);
+	} else {
+		/* One way sized chunk per huge page, same partitioning as
+		 * pirate_loop_fix() */
+		const int chunk = a->way_size / a->n_pirates;
+		const int start = a->pirate_number * chunk;
+		const int last_element = (a->size / a->way_size) * a->chunk_stride
+			+ (a->size % a->way_size);
+
+		do {
+			pirate_pace_start(&pace);
+			for (int i = start; i < last_element; i += a->chunk_stride) {
+				const int limit = MIN(i + chunk, last_element);
+				if (!touch(data + i, limit - i, a->stride, &pace))
+					return;
+			}
+			if (a->publish)
+				a->publish(a->pirate_number);
+		} while (*a->epoch == a->run_epoch);
+	}
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PIRATE_KERNELS_H
+#define PIRATE_KERNELS_H
+
+#include <stdint.h>
+
+#include "perfpirate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MLP_DEFAULT_STREAMS 4
+
+/**
+ * Spin for loops iterations of an empty loop, the delay after every
+ * line with --governor. The iterations per ns are calibrated at
+ * startup.
+ */
+static inline void
+pirate_delay(uint32_t loops)
+{
+    for (uint32_t i = 0; i < loops; i++)
+        __asm__ __volatile__("");
+}
+
+/* Lines between the checks of a delayed pass */
+#define PIRATE_POLL_LINES 64
+/* Lines between the checks of a pass that isn't delayed */
+#define PIRATE_PUBLISH_LINES 1024
+
+/*
+ * Pacing of a pass. Every few lines, a pass publishes its counters,
+ * picks up the current --governor delay and checks for a new epoch.
+ * A pass over a large pirate size, or at a long delay, could
+ * otherwise leave the sampler with an old counter snapshot and hold
+ * up a size change for a long time. Delayed passes check every
+ * PIRATE_POLL_LINES lines, the others every PIRATE_PUBLISH_LINES.
+ */
+typedef struct {
+    const volatile uint32_t *delay;
+    const volatile uint32_t *epoch;
+    /* Publishes the pirate's counters for the sampler, may be NULL */
+    void (*publish)(int pirate_number);
+    int pirate_number;
+    /* Epoch at the start of the pass */
+    uint32_t pass_epoch;
+    /* pirate_delay() loops after every line */
+    uint32_t loops;
+    /* Lines until the next check */
+    int left;
+} pirate_pace_t;
+
+static inline void
+pirate_pace_reload(pirate_pace_t *p)
+{
+    p->loops = p->delay ? *p->delay : 0;
+    p->left = p->loops ? PIRATE_POLL_LINES : PIRATE_PUBLISH_LINES;
+}
+
+static inline void
+pirate_pace_start(pirate_pace_t *p)
+{
+    p->pass_epoch = *p->epoch;
+    pirate_pace_reload(p);
+}
+
+/**
+ * Delay after lines lines of a pass.
+ *
+ * @return 0 if a new epoch has started, which ends the pass. The
+ * counters have been published by then.
+ */
+static inline int
+pirate_pace(pirate_pace_t *p, int lines)
+{
+    if (p->loops)
+        pirate_delay(lines * p->loops);
+    if ((p->left -= lines) > 0)
+        return 1;
+
+    if (p->publish)
+        p->publish(p->pirate_number);
+    pirate_pace_reload(p);
+    return *p->epoch == p->pass_epoch;
+}
+
+/* Everything a pirate kernel needs to know about its data set */
+typedef struct {
+    char *data;
+    /* Current pirate size */
+    int size;
+    int stride;
+    int way_size;
+    /* Distance between the way sized chunks of the loop_fix layout */
+    int chunk_stride;
+    int loop_fix;
+    int n_pirates;
+    int pirate_number;
+    /* The kernel runs until *epoch != run_epoch, at least one pass */
+    const volatile uint32_t *epoch;
+    uint32_t run_epoch;
+    /* Publishes the counters after every pass and during a pass,
+     * see pirate_pace_t, may be NULL */
+    void (*publish)(int pirate_number);
+    /* pirate_delay() loops after every line, see pirate_pace_t */
+    const volatile uint32_t *delay;
+} pirate_kernel_args_t;
+
+/* A compile time specialized variant of the mlp kernel */
+typedef struct {
+    char name[32];
+    /* Vector instruction set, "avx2", "sse2" or "scalar" */
+    const char *isa;
+    /* Number of independent streams */
+    int streams;
+    /* Compile time stride, 0 if the stride is a run time parameter */
+    int stride;
+} pirate_variant_t;
+
+/**
+ * Set up the table of mlp kernel variants the CPU supports.
+ *
+ * @param stride Stride the kernels will be used with
+ *
+ * @return Number of variants
+ */
+int pirate_variants_init(int stride);
+
+/**
+ * Description of a variant, 0 <= variant < pirate_variants_init().
+ */
+const pirate_variant_t *pirate_variant(int variant);
+
+/**
+ * Find the variant with the given number of streams that uses the
+ * widest vector instruction set.
+ *
+ * @return Variant number, -1 if there is no such variant.
+ */
+int pirate_variant_find(int streams);
+
+/**
+ * High memory level parallelism pirate kernel. The pirate's part of
+ * the data set is split into several streams which are walked in
+ * lock step, loading each line with a vector load.
+ *
+ * @param args Data set and pirate description
+ * @param variant Kernel variant to use
+ */
+void pirate_loop_variant(const pirate_kernel_args_t *args, int variant);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
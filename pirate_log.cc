@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "expect.h"
+#include "pirate_log.h"
+
+int
+plog_open(pirate_log_t *log, const char *file, string *err)
+{
+	struct stat st;
+	size_t pos;
+	uint32_t length;
+
+	log->fd = -1;
+	log->data = NULL;
+	log->size = 0;
+	log->dumps.clear();
+	log->error.clear();
+
+	if ((log->fd = open(file, O_RDONLY)) == -1 || fstat(log->fd, &st)) {
+		*err = strerror(errno);
+		plog_close(log);
+		return -1;
+	}
+
+	log->size = st.st_size;
+	if (log->size) {
+		void *data = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE,
+				  log->fd, 0);
+		if (data == MAP_FAILED) {
+			*err = strerror(errno);
+			log->size = 0;
+			plog_close(log);
+			return -1;
+		}
+		log->data = (const char *)data;
+		madvise(data, log->size, MADV_SEQUENTIAL);
+	}
+
+	if (log->size < strlen(PLOG_MAGIC) ||
+	    memcmp(log->data, PLOG_MAGIC, strlen(PLOG_MAGIC))) {
+		*err = "Invalid magic in file header";
+		plog_close(log);
+		return -1;
+	}
+	pos = strlen(PLOG_MAGIC);
+
+	if (log->size - pos < sizeof(length)) {
+		*err = "Failed to read header";
+		plog_close(log);
+		return -1;
+	}
+	memcpy(&length, log->data + pos, sizeof(length));
+	pos += sizeof(length);
+	if (log->size - pos < length ||
+	    !log->header.ParseFromArray(log->data + pos, length)) {
+		*err = "Failed to read header";
+		plog_close(log);
+		return -1;
+	}
+	pos += length;
+
+	/* Same rules as pirate.py: a length without a message is the end
+	 * of the log, a partial message is an error */
+	while (pos < log->size) {
+		if (log->size - pos < sizeof(length)) {
+			log->error = "Unexpected EOF while reading packet length";
+			break;
+		}
+		memcpy(&length, log->data + pos, sizeof(length));
+		if (log->size - pos == sizeof(length) || !length)
+			break;
+		if (log->size - pos - sizeof(length) < length) {
+			log->error = "Unexpected EOF while reading packet";
+			break;
+		}
+		log->dumps.push_back(pos);
+		pos += sizeof(length) + length;
+	}
+
+	return 0;
+}
+
+void
+plog_close(pirate_log_t *log)
+{
+	if (log->data)
+		munmap((void *)log->data, log->size);
+	if (log->fd != -1)
+		close(log->fd);
+	log->fd = -1;
+	log->data = NULL;
+	log->size = 0;
+	log->dumps.clear();
+}
+
+bool
+plog_dump(const pirate_log_t *log, size_t i, PerfCtrDump *dump)
+{
+	const size_t pos = log->dumps[i];
+	uint32_t length;
+
+	memcpy(&length, log->data + pos, sizeof(length));
+	return dump->ParseFromArray(log->data + pos + sizeof(length), length);
+}
+
+typedef struct {
+	const pirate_log_t *log;
+	plog_chunk_fn decode;
+	void *arg;
+	size_t chunk;
+	int slot;
+	pthread_t thread;
+} plog_worker_t;
+
+static void *
+plog_worker_main(void *_worker)
+{
+	plog_worker_t *w = (plog_worker_t *)_worker;
+	const size_t begin = w->chunk * PLOG_CHUNK_DUMPS;
+	const size_t end = min(begin + PLOG_CHUNK_DUMPS, w->log->dumps.size());
+
+	w->decode(w->log, w->chunk, w->slot, begin, end, w->arg);
+	return NULL;
+}
+
+void
+plog_parallel(const pirate_log_t *log, int n_threads,
+	      plog_chunk_fn decode, plog_chunk_fn done, void *arg)
+{
+	const size_t n_chunks =
+		(log->dumps.size() + PLOG_CHUNK_DUMPS - 1) / PLOG_CHUNK_DUMPS;
+	vector<plog_worker_t> workers(n_threads);
+
+	/* Chunks are handed out in batches of one per thread, so that
+	 * the done callbacks can run in order between the batches */
+	for (size_t base = 0; base < n_chunks; base += n_threads) {
+		const int n = min((size_t)n_threads, n_chunks - base);
+
+		for (int t = 0; t < n; t++) {
+			plog_worker_t *w = &workers[t];
+
+			w->log = log;
+			w->decode = decode;
+			w->arg = arg;
+			w->chunk = base + t;
+			w->slot = t;
+			EXPECT(pthread_create(&w->thread, NULL,
+					      &plog_worker_main, w) == 0);
+		}
+
+		for (int t = 0; t < n; t++) {
+			plog_worker_t *w = &workers[t];
+			const size_t begin = w->chunk * PLOG_CHUNK_DUMPS;
+
+			EXPECT(pthread_join(w->thread, NULL) == 0);
+			if (done)
+				done(log, w->chunk, t, begin,
+				     min(begin + PLOG_CHUNK_DUMPS,
+					 log->dumps.size()), arg);
+		}
+	}
+}
+
+int
+plog_default_threads()
+{
+	cpu_set_t cpu_set;
+
+	if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set))
+		return 1;
+	return CPU_COUNT(&cpu_set);
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
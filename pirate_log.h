@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Native reader for PIRATEv1 logs.
+ *
+ * The log is mmapped and the length prefixes of all dumps are
+ * scanned once to index the file. The dumps are then decoded in
+ * chunks of PLOG_CHUNK_DUMPS, in parallel on several threads, see
+ * plog_parallel().
+ */
+
+#ifndef PIRATE_LOG_H
+#define PIRATE_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "perf_pb.pb.h"
+
+#define PLOG_MAGIC "PIRATEv1"
+#define PLOG_CHUNK_DUMPS 65536
+
+typedef struct {
+    int fd;
+    const char *data;
+    size_t size;
+    PerfHeader header;
+    /* Offset of the length prefix of every dump */
+    std::vector<size_t> dumps;
+    /* Set if the log ends in a partial dump, the dumps before it are
+     * still indexed */
+    std::string error;
+} pirate_log_t;
+
+/**
+ * Called for a chunk of dumps [begin, end).
+ *
+ * @param slot Thread slot, 0 to n_threads - 1. No two chunks with the
+ *             same slot are handled at the same time.
+ */
+typedef void (*plog_chunk_fn)(const pirate_log_t *log, size_t chunk,
+                              int slot, size_t begin, size_t end,
+                              void *arg);
+
+/**
+ * Open and index a log. A partial dump at the end of the log isn't a
+ * failure, it sets log->error.
+ *
+ * @param err Set to a description of the error on failure
+ *
+ * @return 0 on success, -1 on error.
+ */
+int plog_open(pirate_log_t *log, const char *file, std::string *err);
+
+void plog_close(pirate_log_t *log);
+
+/**
+ * Decode dump i of the log.
+ *
+ * @return true on success, false if the message is corrupt.
+ */
+bool plog_dump(const pirate_log_t *log, size_t i, PerfCtrDump *dump);
+
+/**
+ * Decode the chunks of a log on n_threads threads.
+ *
+ * @param decode Called for every chunk on a worker thread
+ * @param done Called for every chunk on the calling thread, in chunk
+ *             order, after decode has returned. May be NULL.
+ */
+void plog_parallel(const pirate_log_t *log, int n_threads,
+                   plog_chunk_fn decode, plog_chunk_fn done, void *arg);
+
+/**
+ * Number of CPUs available to the process, the default number of
+ * decoding threads.
+ */
+int plog_default_threads();
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
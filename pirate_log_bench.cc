@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark for the native log reader. Writes a synthetic
+ * PIRATEv1 log of the requested size, unless the file exists, and
+ * measures indexing and decoding it with 1 to all CPUs.
+ */
+
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "expect.h"
+#include "pirate_log.h"
+
+#define BENCH_T_CTRS 4
+#define BENCH_PIRATES 2
+#define BENCH_P_CTRS 2
+#define BENCH_SIZES 64
+
+static double
+now()
+{
+	struct timespec ts;
+
+	EXPECT(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+static void
+write_message(ofstream &out, const google::protobuf::Message &msg)
+{
+	string buf;
+	uint32_t length;
+
+	EXPECT(msg.SerializeToString(&buf));
+	length = buf.size();
+	out.write((const char *)&length, sizeof(length));
+	out.write(buf.data(), buf.size());
+}
+
+/* Roughly the header and samples of a four counter sweep */
+static void
+write_log(const char *file, uint64_t bytes)
+{
+	ofstream out(file, ios::out | ios::binary | ios::trunc);
+	PerfHeader header;
+	PerfCtrDump dump;
+	uint64_t written = 0;
+	unsigned seed = 1;
+
+	EXPECT(out.good());
+
+	header.mutable_t_setup()->set_cpu(0);
+	header.mutable_t_setup()->set_sample_period(100000000);
+	header.mutable_t_setup()->set_n_ctrs(BENCH_T_CTRS);
+	header.mutable_t_setup()->set_command("synthetic");
+	for (int i = 0; i < BENCH_T_CTRS; i++) {
+		PerfCtrInfo *ctr = header.mutable_t_setup()->add_ctr();
+		ctr->set_id(i);
+		ctr->set_name(i ? "synthetic" : "INSTRUCTIONS_RETIRED");
+	}
+	header.mutable_p_setup()->set_n_pirates(BENCH_PIRATES);
+	header.mutable_p_setup()->set_n_ctrs(BENCH_P_CTRS);
+	for (int i = 0; i < BENCH_P_CTRS; i++) {
+		PerfCtrInfo *ctr = header.mutable_p_setup()->add_ctr();
+		ctr->set_id(i);
+		ctr->set_name("synthetic");
+	}
+
+	out.write(PLOG_MAGIC, strlen(PLOG_MAGIC));
+	write_message(out, header);
+
+	for (uint64_t i = 0; written < bytes; i++) {
+		PerfCtrSample *t_sample;
+
+		dump.Clear();
+		t_sample = dump.mutable_t_sample();
+		t_sample->set_size((i % BENCH_SIZES) << 16);
+		t_sample->add_ctr(100000000 + rand_r(&seed) % 1000);
+		for (int c = 1; c < BENCH_T_CTRS; c++)
+			t_sample->add_ctr(rand_r(&seed));
+		for (int p = 0; p < BENCH_PIRATES; p++) {
+			PerfCtrSample *p_sample = dump.add_p_sample();
+			for (int c = 0; c < BENCH_P_CTRS; c++)
+				p_sample->add_ctr(rand_r(&seed));
+		}
+		dump.set_time(i * 25000000ULL);
+		dump.set_size_time(i * 25000000ULL);
+
+		write_message(out, dump);
+		written += sizeof(uint32_t) + dump.ByteSizeLong();
+	}
+
+	EXPECT(out.good());
+}
+
+typedef struct {
+	vector<uint64_t> sum;
+} bench_slot_t;
+
+static void
+bench_decode(const pirate_log_t *log, size_t chunk, int slot,
+	     size_t begin, size_t end, void *arg)
+{
+	bench_slot_t *s = &((vector<bench_slot_t> *)arg)->at(slot);
+	PerfCtrDump dump;
+
+	for (size_t i = begin; i < end; i++) {
+		EXPECT(plog_dump(log, i, &dump));
+		for (int c = 0; c < dump.t_sample().ctr_size() &&
+			     c < BENCH_T_CTRS; c++)
+			s->sum[c] += dump.t_sample().ctr(c);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *file = argc > 1 ? argv[1] : "pirate_bench.log";
+	const uint64_t mbytes = argc > 2 ? strtoull(argv[2], NULL, 0) : 2048;
+	const int max_threads = plog_default_threads();
+	pirate_log_t log;
+	string err;
+	double start, t;
+
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+	/* The log is written to LOG, don't take an option for it */
+	if (argc > 3 || (argc > 1 && argv[1][0] == '-') || mbytes < 1) {
+		fprintf(stderr, "Usage: %s [LOG [MB]]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (access(file, R_OK)) {
+		printf("Writing %" PRIu64 " MB synthetic log to %s...\n",
+		       mbytes, file);
+		write_log(file, mbytes << 20);
+	}
+
+	start = now();
+	if (plog_open(&log, file, &err)) {
+		fprintf(stderr, "Failed to read pirate log: %s\n", err.c_str());
+		exit(2);
+	}
+	t = now() - start;
+	printf("Index: %zu dumps, %.1f MB in %.3f s (%.0f MB/s)\n",
+	       log.dumps.size(), log.size / 1E6, t, log.size / 1E6 / t);
+
+	for (int n = 1;; n = min(2 * n, max_threads)) {
+		vector<bench_slot_t> slots(n);
+
+		for (int i = 0; i < n; i++)
+			slots[i].sum.assign(BENCH_T_CTRS, 0);
+
+		start = now();
+		plog_parallel(&log, n, &bench_decode, NULL, &slots);
+		t = now() - start;
+		printf("Decode, %i threads: %.3f s (%.0f MB/s, %.2f M dumps/s)\n",
+		       n, t, log.size / 1E6 / t, log.dumps.size() / 1E6 / t);
+
+		if (n == max_threads)
+			break;
+	}
+
+	plog_close(&log);
+	return 0;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
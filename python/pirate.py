@@ -31,8 +31,14 @@
 
 import sys
 import struct
+import mmap
 from perf_pb_pb2 import *
 
+MAGIC_V1 = "PIRATEv1"
+MAGIC_V2 = "PIRATEv2"
+INDEX_MAGIC_V2 = "PIRIDXv2"
+MAGIC_SUMMARY = "PIRATEs1"
+
 def _read_magic(f, magic):
     """Read and compare the magic value in a data file.
 
@@ -98,7 +104,7 @@ def read_header(fin):
     Exceptions:
        RuntimeError on EOF.
     """
-    if not _read_magic(fin, "PIRATEv1"):
+    if not _read_magic(fin, MAGIC_V1):
         raise RuntimeError("Invalid magic in file header")
 
     header = _read_entry(fin, PerfHeader)
@@ -124,3 +130,192 @@ def stream_dumps(fin):
         if dump is None:
             break
         yield dump
+
+class ColumnarLog(object):
+    """Random access to a columnar (PIRATEv2) pirate log.
+
+    The file is mmapped, only the header and the block index at the
+    end of the file are decoded when it is opened. Blocks are selected
+    through the index and columns are decoded on demand.
+
+    Attributes:
+      header - PerfHeader object.
+      columns - Column names, in storage order.
+      blocks - List of (offset, n_rows, p_size, first_cycle,
+               last_cycle) tuples, one per block.
+    """
+
+    _BLOCK_HEAD = struct.Struct("<II")
+    _INDEX_ENTRY = struct.Struct("<QIIII")
+    _TRAILER = struct.Struct("<QQ8s")
+
+    def __init__(self, f):
+        self.mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        if self.mm[0:len(MAGIC_V2)] != MAGIC_V2:
+            raise RuntimeError("Invalid magic in file header")
+
+        (length, ) = struct.unpack_from("<I", self.mm, len(MAGIC_V2))
+        start = len(MAGIC_V2) + 4
+        self.header = PerfHeader()
+        self.header.ParseFromString(self.mm[start:start + length])
+        self.columns = list(self.header.columnar.column)
+        self._col = dict((n, i) for (i, n) in enumerate(self.columns))
+
+        if len(self.mm) < self._TRAILER.size:
+            raise RuntimeError("Unexpected EOF while reading trailer")
+        (index_offset, n_entries, magic) = self._TRAILER.unpack_from(
+            self.mm, len(self.mm) - self._TRAILER.size)
+        if magic != INDEX_MAGIC_V2:
+            raise RuntimeError("Invalid index magic, truncated log?")
+
+        self.blocks = [ self._INDEX_ENTRY.unpack_from(
+                self.mm, index_offset + i * self._INDEX_ENTRY.size)
+                        for i in range(n_entries) ]
+
+    def sizes(self):
+        """Return a sorted list of all pirate sizes in the log."""
+        return sorted(set(b[2] for b in self.blocks))
+
+    def select(self, p_size=None, cycle=None):
+        """Return the index entries of the blocks matching a pirate
+        size and/or a sweep cycle."""
+        return [ b for b in self.blocks
+                 if (p_size is None or b[2] == p_size) and
+                 (cycle is None or b[3] <= cycle <= b[4]) ]
+
+    def column(self, block, name):
+        """Decode a single column of a block.
+
+        Arguments:
+          block - Index entry as returned by select().
+          name - Column name, see the columns attribute.
+
+        Returns:
+          Tuple of values.
+        """
+        (offset, n_rows, p_size, first_cycle, last_cycle) = block
+        (_n_rows, n_cols) = self._BLOCK_HEAD.unpack_from(self.mm, offset)
+        assert _n_rows == n_rows and n_cols == len(self.columns)
+        start = offset + self._BLOCK_HEAD.size + self._col[name] * n_rows * 8
+        return struct.unpack_from("<%iQ" % n_rows, self.mm, start)
+
+    def rows(self, block):
+        """Decode all columns of a block and return them row by row."""
+        return zip(*[ self.column(block, c) for c in self.columns ])
+
+    def stream_dumps(self, p_size=None):
+        """Yield PerfCtrDump objects, ordered by block, for
+        compatibility with PIRATEv1 consumers."""
+        t_cols = [ self._col["t:" + c.name] for c in self.header.t_setup.ctr ]
+        p_cols = [ [ self._col["p%i:%s" % (j, c.name)]
+                     for c in self.header.p_setup.ctr ]
+                   for j in range(self.header.p_setup.n_pirates) ]
+        # Counters of each bandit, followed by the bytes it wrote
+        b_cols = [ [ self._col["b%i:%s" % (j, c.name)]
+                     for c in self.header.b_setup.ctr ] +
+                   [ self._col["b%i:bytes" % j] ]
+                   for j in range(len(self.header.b_setup.cpu)) ]
+        m_cols = [ self._col["m:" + m.name] for m in self.header.metric ]
+        for b in self.select(p_size=p_size):
+            for row in self.rows(b):
+                dump = PerfCtrDump()
+                dump.t_sample.size = row[self._col["size"]]
+                dump.t_sample.ctr.extend([ row[i] for i in t_cols ])
+                for cols in p_cols:
+                    p = dump.p_sample.add()
+                    p.size = b[2]
+                    p.ctr.extend([ row[i] for i in cols ])
+                for cols in b_cols:
+                    dump.b_sample.add().ctr.extend([ row[i] for i in cols ])
+                if b_cols:
+                    dump.bandit_rate = row[self._col["bandit_rate"]]
+                if "pirate_delay" in self._col and row[self._col["pirate_delay"]]:
+                    dump.pirate_delay = row[self._col["pirate_delay"]]
+                # Metrics are stored as the bits of a double
+                dump.metric.extend([ struct.unpack("<d", struct.pack("<Q", row[i]))[0]
+                                     for i in m_cols ])
+                if "schedule" in self._col:
+                    dump.schedule = row[self._col["schedule"]]
+                if "heat_time" in self._col and row[self._col["heat_time"]]:
+                    dump.heat_time = row[self._col["heat_time"]]
+                if "phase" in self._col:
+                    dump.phase = row[self._col["phase"]]
+                if "group" in self._col and self.header.t_setup.group:
+                    dump.group = row[self._col["group"]]
+                if row[self._col["time"]]:
+                    dump.time = row[self._col["time"]]
+                    dump.size_time = row[self._col["size_time"]]
+                yield dump
+
+def read_summary(fin):
+    """Read a summary file written with --summary.
+
+    Arguments:
+       fin - Input file.
+
+    Returns:
+       Tuple of the PerfHeader and PerfSummary objects.
+
+    Exceptions:
+       RuntimeError on EOF.
+    """
+    if not _read_magic(fin, MAGIC_SUMMARY):
+        raise RuntimeError("Invalid magic in summary header")
+
+    header = _read_entry(fin, PerfHeader)
+    summary = _read_entry(fin, PerfSummary)
+    if header is None or summary is None:
+        raise RuntimeError("Failed to read summary")
+
+    return (header, summary)
+
+def summary_dumps(summary):
+    """Turn the sums of a summary into one PerfCtrDump per size, bandit
+    rate, group and phase. Summing these gives the same result as summing the
+    samples of the run.
+
+    Arguments:
+       summary - PerfSummary object.
+    """
+    for s in summary.size:
+        dump = PerfCtrDump()
+        dump.t_sample.size = s.size
+        dump.t_sample.ctr.extend(s.target.sum)
+        for p in s.pirate:
+            p_sample = dump.p_sample.add()
+            p_sample.size = s.p_size
+            p_sample.ctr.extend(p.sum)
+        for b in s.bandit:
+            dump.b_sample.add().ctr.extend(b.sum)
+        if s.bandit:
+            dump.bandit_rate = s.bandit_rate
+        if s.pirate_delay:
+            dump.pirate_delay = s.pirate_delay
+        dump.group = s.group
+        dump.phase = s.phase
+        dump.metric.extend(s.metric)
+        yield dump
+
+def open_log(fin):
+    """Open a pirate log of either format.
+
+    Arguments:
+       fin - Input file.
+
+    Returns:
+       Tuple of the PerfHeader object and a generator of PerfCtrDump
+       objects. A summary file gives one dump per size, see
+       summary_dumps().
+    """
+    magic = fin.read(len(MAGIC_V1))
+    fin.seek(0)
+    if magic == MAGIC_V2:
+        log = ColumnarLog(fin)
+        return (log.header, log.stream_dumps())
+    elif magic == MAGIC_SUMMARY:
+        (header, summary) = read_summary(fin)
+        return (header, summary_dumps(summary))
+    else:
+        header = read_header(fin)
+        return (header, stream_dumps(fin))
@@ -46,19 +46,46 @@ class Dump(object):
         self.size = pb_dump.t_sample.size
         self.target = CtrSample(pb_dump.t_sample)
         self.pirates = [ CtrSample(p) for p in pb_dump.p_sample ]
+        # Counters of each bandit followed by the bytes it wrote
+        self.bandit_rate = pb_dump.bandit_rate
+        self.bandits = [ CtrSample(b) for b in pb_dump.b_sample ]
+        # Instructions counted by each multiplexed group
+        self.leaders = { pb_dump.group : pb_dump.t_sample.ctr[0] }
 
     def add(self, dump):
         assert self.size == dump.size
+        assert self.bandit_rate == dump.bandit_rate
 
         self.target.add(dump.target)
         for p_self, p_dump in zip(self.pirates, dump.pirates):
             p_self.add(p_dump)
-
-    def print_csv(self, ofs=" "):
+        for b_self, b_dump in zip(self.bandits, dump.bandits):
+            b_self.add(b_dump)
+        for g, insns in dump.leaders.items():
+            self.leaders[g] = self.leaders.get(g, 0) + insns
+
+    def target_counters(self, groups):
+        """Scale every multiplexed event to all instructions at this size."""
+        if not groups:
+            return self.target.counters
+
+        counters = list(self.target.counters)
+        total = sum(self.leaders.values())
+        for group in groups:
+            insns = self.leaders.get(group.id, 0)
+            for i in group.ctr[1:]:
+                counters[i] = counters[i] * total / insns if insns else 0
+        return counters
+
+    def print_csv(self, ofs=" ", groups=None):
         fields = [ "%i" % self.size ]
-        fields += [ "%li" % c for c in self.target.counters ]
+        fields += [ "%li" % c for c in self.target_counters(groups) ]
         for p in self.pirates:
             fields += [ "%li" % c for c in p.counters ]
+        if self.bandits:
+            fields += [ "%i" % self.bandit_rate ]
+        for b in self.bandits:
+            fields += [ "%li" % c for c in b.counters ]
 
         print ofs.join(fields)
         
@@ -73,6 +100,7 @@ def print_header(header, comment="#", cur_field=1):
         "way_size" : header.p_setup.way_size,
         "stride" : header.p_setup.stride,
         "pirate_cpus" : ",".join([ str(c) for c in header.p_setup.cpu ]),
+        "kernel" : header.p_setup.variant or header.p_setup.kernel,
         "reference_size" : header.reference.size,
         "reference" : " ".join(["%li" % r for r in header.reference.ctr ]),
     }
@@ -93,6 +121,12 @@ def print_header(header, comment="#", cur_field=1):
                   for (i, ctr) in enumerate(header.t_setup.ctr) ]
     cur_field += len(header.t_setup.ctr)
 
+    if header.t_setup.group:
+        csv_head += [ "\tCounter groups (scaled to all instructions):" ]
+        csv_head += [ "\t\t %i: %s" % (group.id, " ".join(
+            [ header.t_setup.ctr[i].name for i in group.ctr ]))
+                      for group in header.t_setup.group ]
+
     csv_head += [
         "Pirate:",
         "\tWays: %(cache_ways)i",
@@ -100,6 +134,13 @@ def print_header(header, comment="#", cur_field=1):
         "\tWay size: %(way_size)i",
         "\tStride: %(stride)i",
         "\tCPU: %(pirate_cpus)s",
+        "\tKernel: %(kernel)s",
+    ]
+
+    csv_head += [ "\t\t %s: %.0f lines/s" % (cal.kernel, cal.access_rate)
+                  for cal in header.p_setup.calibration ]
+
+    csv_head += [
         "\tCounters:",
     ]
         
@@ -112,6 +153,46 @@ def print_header(header, comment="#", cur_field=1):
         "\tReference:\t%(reference)s",
     ]
 
+    if header.HasField("b_setup"):
+        b_setup = header.b_setup
+        # The bandit fields follow the counters of every pirate
+        cur_field += len(header.p_setup.ctr) * \
+            (len(header.p_setup.cpu) - 1)
+        csv_head += [
+            "Bandit:",
+            "\tCPU: %s" % ",".join([ str(c) for c in b_setup.cpu ]),
+            "\tSize: %i" % b_setup.size,
+            "\tRates: %s" % ",".join([ str(r) for r in b_setup.rate ]),
+            "\t\t %i: Bandit rate (MB/s)" % cur_field,
+            "\tCounters:",
+        ]
+        cur_field += 1
+        names = [ ctr.name for ctr in b_setup.ctr ] + [ "bytes" ]
+        for b in range(len(b_setup.cpu)):
+            csv_head += [ "\t\t %i: b%i:%s" % (i + cur_field, b, name)
+                          for (i, name) in enumerate(names) ]
+            cur_field += len(names)
+
+    if header.HasField("adaptive"):
+        csv_head += [
+            "Adaptive sweep:\tMetric: %s\tCI width: %g\tMin step: %i" % (
+                header.adaptive.metric, header.adaptive.ci_width,
+                header.adaptive.min_step),
+        ]
+
+    for dom in header.domain:
+        csv_head += [
+            "Domain %i:\tTarget CPU: %i\tPirate CPUs: %s\tSizes: %i + n * %i" % (
+                dom.domain, dom.t_cpu, ",".join([ str(c) for c in dom.p_cpu ]),
+                dom.sweep_start, dom.sweep_step),
+        ]
+
+    for ref in header.kernel_reference:
+        csv_head += [
+            "\tReference (%s kernel):\t%s" % (
+                ref.kernel, " ".join(["%li" % r for r in ref.sample.ctr ])),
+        ]
+
     for l in csv_head:
         print comment + " " + l % fmt_entries
 
@@ -130,28 +211,36 @@ def main():
     parser.add_argument('--no-aggregate', action="store_true", default=False,
                         help="Don't sum counters")
 
+    parser.add_argument('--phase', choices=[ "all", "discard", "measured" ],
+                        default="all",
+                        help="Only use this part of samples split by --discard")
+
     args = parser.parse_args()
 
     try:
-        header = pirate.read_header(args.log)
+        (header, dumps) = pirate.open_log(args.log)
         if not args.no_header:
             print_header(header)
 
         d_agg = {}
-        for _d in pirate.stream_dumps(args.log):
+        for _d in dumps:
+            if args.phase == "discard" and _d.phase != pirate.DISCARD or \
+               args.phase == "measured" and _d.phase == pirate.DISCARD:
+                continue
             d = Dump(_d)
+            key = (d.size, d.bandit_rate)
             if args.no_aggregate:
                 d.print_csv(ofs=args.fs)
-            elif d.size in d_agg:
-                d_agg[d.size].add(d)
+            elif key in d_agg:
+                d_agg[key].add(d)
             else:
-                d_agg[d.size] = d
+                d_agg[key] = d
 
         if not args.no_aggregate:
             sizes = d_agg.items()
-            sizes.sort(key=lambda (size, dump): size)
-            for size, dump in sizes:
-                dump.print_csv(ofs=args.fs)
+            sizes.sort(key=lambda (key, dump): key)
+            for key, dump in sizes:
+                dump.print_csv(ofs=args.fs, groups=header.t_setup.group)
     except RuntimeError, e:
         print >> sys.stderr, "Failed to read pirate log: %s" % e
         sys.exit(2)
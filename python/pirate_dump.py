@@ -42,9 +42,9 @@ def main():
     args = parser.parse_args()
 
     try:
-        header = pirate.read_header(args.log)
+        (header, dumps) = pirate.open_log(args.log)
         print header
-        for d in pirate.stream_dumps(args.log):
+        for d in dumps:
             print d
     except RuntimeError, e:
         print >> sys.stderr, "Failed to read pirate log: %s" % e
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "expect.h"
+#include "schedule.h"
+
+static void
+fill_ramp(schedule_t *s, const schedule_conf_t *conf)
+{
+    EXPECT(conf->step > 0 && conf->first <= conf->last);
+
+    s->n_sizes = (conf->last - conf->first) / conf->step + 1;
+    EXPECT(s->sizes = malloc(s->n_sizes * sizeof(uint32_t)));
+    for (int i = 0; i < s->n_sizes; i++)
+        s->sizes[i] = conf->first + i * conf->step;
+}
+
+/* Visit the sizes in order and start over */
+static sweep_status_t
+cyclic_next(schedule_t *s, uint32_t *size)
+{
+    sweep_status_t status = SWEEP_STEP;
+
+    if (++s->pos == s->n_sizes) {
+        s->pos = 0;
+        status = SWEEP_NEW_CYCLE;
+    }
+    *size = s->sizes[s->pos];
+    return status;
+}
+
+static uint32_t
+ascending_init(schedule_t *s, const schedule_conf_t *conf)
+{
+    fill_ramp(s, conf);
+    return s->sizes[0];
+}
+
+static uint32_t
+descending_init(schedule_t *s, const schedule_conf_t *conf)
+{
+    fill_ramp(s, conf);
+    for (int i = 0; i < s->n_sizes / 2; i++) {
+        const uint32_t tmp = s->sizes[i];
+        s->sizes[i] = s->sizes[s->n_sizes - 1 - i];
+        s->sizes[s->n_sizes - 1 - i] = tmp;
+    }
+    return s->sizes[0];
+}
+
+static uint32_t
+zigzag_init(schedule_t *s, const schedule_conf_t *conf)
+{
+    fill_ramp(s, conf);
+    s->dir = 1;
+    return s->sizes[0];
+}
+
+/* Up and then down again, the end points are sampled twice in a row,
+ * once for each cycle */
+static sweep_status_t
+zigzag_next(schedule_t *s, uint32_t *size)
+{
+    sweep_status_t status = SWEEP_STEP;
+    const int next = s->pos + s->dir;
+
+    if (next < 0 || next >= s->n_sizes) {
+        s->dir = -s->dir;
+        status = SWEEP_NEW_CYCLE;
+    } else
+        s->pos = next;
+
+    *size = s->sizes[s->pos];
+    return status;
+}
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void
+shuffle(schedule_t *s)
+{
+    for (int i = s->n_sizes - 1; i > 0; i--) {
+        const int j = xorshift64(&s->rng) % (i + 1);
+        const uint32_t tmp = s->sizes[i];
+        s->sizes[i] = s->sizes[j];
+        s->sizes[j] = tmp;
+    }
+}
+
+static uint32_t
+random_init(schedule_t *s, const schedule_conf_t *conf)
+{
+    fill_ramp(s, conf);
+    s->rng = conf->seed ? conf->seed : 1;
+    shuffle(s);
+    return s->sizes[0];
+}
+
+/* A new permutation every cycle */
+static sweep_status_t
+random_next(schedule_t *s, uint32_t *size)
+{
+    const sweep_status_t status = cyclic_next(s, size);
+
+    if (status == SWEEP_NEW_CYCLE) {
+        shuffle(s);
+        *size = s->sizes[0];
+    }
+    return status;
+}
+
+static uint32_t
+list_init(schedule_t *s, const schedule_conf_t *conf)
+{
+    EXPECT(conf->list_len > 0);
+
+    s->n_sizes = conf->list_len;
+    EXPECT(s->sizes = malloc(s->n_sizes * sizeof(uint32_t)));
+    memcpy(s->sizes, conf->list, s->n_sizes * sizeof(uint32_t));
+    return s->sizes[0];
+}
+
+static uint32_t
+adaptive_init(schedule_t *s, const schedule_conf_t *conf)
+{
+    return sweep_init(&s->sweep, conf->first, conf->step, conf->last,
+                      conf->min_step, conf->ci_width, conf->min_samples);
+}
+
+static sweep_status_t
+adaptive_next(schedule_t *s, uint32_t *size)
+{
+    return sweep_next(&s->sweep, size);
+}
+
+static void
+adaptive_add(schedule_t *s, uint32_t size, double value)
+{
+    sweep_add(&s->sweep, size, value);
+}
+
+/* Indexed by schedule_id_t */
+static const schedule_ops_t schedules[] = {
+    { "ascending", ascending_init, cyclic_next, NULL },
+    { "descending", descending_init, cyclic_next, NULL },
+    { "zigzag", zigzag_init, zigzag_next, NULL },
+    { "random", random_init, random_next, NULL },
+    { "list", list_init, cyclic_next, NULL },
+    { "adaptive", adaptive_init, adaptive_next, adaptive_add },
+};
+
+#define N_SCHEDULES (sizeof(schedules) / sizeof(*schedules))
+
+int
+schedule_lookup(const char *name, schedule_id_t *id)
+{
+    for (int i = 0; i < N_SCHEDULES; i++) {
+        if (!strcmp(schedules[i].name, name)) {
+            *id = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *
+schedule_name(schedule_id_t id)
+{
+    return id < N_SCHEDULES ? schedules[id].name : "unknown";
+}
+
+uint32_t
+schedule_init(schedule_t *s, schedule_id_t id, const schedule_conf_t *conf)
+{
+    EXPECT(id < N_SCHEDULES);
+
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->ops = &schedules[id];
+    return s->ops->init(s, conf);
+}
+
+sweep_status_t
+schedule_next(schedule_t *s, uint32_t *size)
+{
+    return s->ops->next(s, size);
+}
+
+void
+schedule_add(schedule_t *s, uint32_t size, double value)
+{
+    if (s->ops->add)
+        s->ops->add(s, size, value);
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
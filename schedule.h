@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Sweep schedules, the order in which pirate sizes are visited.
+ *
+ * A schedule is a table of operations and some state. The fixed
+ * schedules visit the sizes first, first + step, ... <= last (or an
+ * explicit list) once per sweep cycle, in different orders. The
+ * adaptive schedule wraps the controller in sweep.h.
+ */
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+
+#include "sweep.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Stored in every sample, keep in sync with Schedule in perf_pb.proto */
+typedef enum {
+    SCHEDULE_ASCENDING = 0,
+    SCHEDULE_DESCENDING = 1,
+    SCHEDULE_ZIGZAG = 2,
+    SCHEDULE_RANDOM = 3,
+    SCHEDULE_LIST = 4,
+    SCHEDULE_ADAPTIVE = 5,
+} schedule_id_t;
+
+typedef struct {
+    /* Sizes of the fixed schedules */
+    uint32_t first;
+    uint32_t step;
+    uint32_t last;
+    /* SCHEDULE_LIST only, visited in this order */
+    const uint32_t *list;
+    int list_len;
+    /* SCHEDULE_RANDOM only */
+    uint64_t seed;
+    /* SCHEDULE_ADAPTIVE only, see sweep_init() */
+    uint32_t min_step;
+    double ci_width;
+    uint32_t min_samples;
+} schedule_conf_t;
+
+typedef struct schedule schedule_t;
+
+typedef struct {
+    const char *name;
+    /* Set up the schedule and return the first size */
+    uint32_t (*init)(schedule_t *s, const schedule_conf_t *conf);
+    sweep_status_t (*next)(schedule_t *s, uint32_t *size);
+    /* Feedback from a sample, may be NULL */
+    void (*add)(schedule_t *s, uint32_t size, double value);
+} schedule_ops_t;
+
+struct schedule {
+    const schedule_ops_t *ops;
+    schedule_id_t id;
+
+    /* Sizes of a cycle, in the order they are visited */
+    uint32_t *sizes;
+    int n_sizes;
+    int pos;
+    /* Zig-zag direction, 1 or -1 */
+    int dir;
+    uint64_t rng;
+
+    sweep_t sweep;
+};
+
+/**
+ * Look up a schedule by name.
+ *
+ * @return 0 on success, -1 if there is no such schedule.
+ */
+int schedule_lookup(const char *name, schedule_id_t *id);
+
+const char *schedule_name(schedule_id_t id);
+
+/**
+ * Set up a schedule.
+ *
+ * @return First size to sample
+ */
+uint32_t schedule_init(schedule_t *s, schedule_id_t id,
+                       const schedule_conf_t *conf);
+
+/**
+ * Pick the next size to sample.
+ */
+sweep_status_t schedule_next(schedule_t *s, uint32_t *size);
+
+/**
+ * Tell the schedule the value of the metric of a sample.
+ */
+void schedule_add(schedule_t *s, uint32_t size, double value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
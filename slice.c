@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "expect.h"
+#include "slice.h"
+
+static void
+swap(uint32_t *a, uint32_t *b)
+{
+    const uint32_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/*
+ * Shrink line[0, *n) to a minimal set that still evicts x, by dropping
+ * every line that isn't needed. The dropped lines are moved to the
+ * end of the array.
+ */
+static void
+reduce(uint32_t x, uint32_t *line, int *n, int ways,
+       slice_evict_fn evicts, void *arg)
+{
+    for (int i = 0; i < *n && *n > ways; ) {
+        swap(&line[i], &line[*n - 1]);
+        if (evicts(arg, x, line, *n - 1)) {
+            (*n)--;
+        } else {
+            swap(&line[i], &line[*n - 1]);
+            i++;
+        }
+    }
+}
+
+int
+slice_split(uint32_t *line, int n, int ways, int max_slices,
+            slice_evict_fn evicts, void *arg, int *slice)
+{
+    int n_slices = 0;
+    /* line[0, done) are assigned to a slice */
+    int done = 0;
+
+    for (int i = 0; i < n; i++)
+        slice[i] = -1;
+
+    while (done < n && n_slices < max_slices) {
+        const uint32_t x = line[done];
+        uint32_t *rest = &line[done + 1];
+        int n_rest = n - done - 1;
+        int n_set = n_rest;
+
+        if (n_rest < ways || !evicts(arg, x, rest, n_rest))
+            break;
+
+        /* rest[0, ways) becomes a minimal eviction set of x */
+        reduce(x, rest, &n_set, ways, evicts, arg);
+        if (n_set != ways)
+            break;
+
+        /* A line is in x's slice if it can replace a member */
+        int members = ways;
+        for (int i = ways; i < n_rest; i++) {
+            const uint32_t first = rest[0];
+
+            rest[0] = rest[i];
+            if (evicts(arg, x, rest, ways)) {
+                rest[i] = rest[members];
+                rest[members++] = rest[0];
+            } else {
+                rest[i] = rest[0];
+            }
+            rest[0] = first;
+        }
+
+        for (int i = done; i < done + 1 + members; i++)
+            slice[i] = n_slices;
+        done += 1 + members;
+        n_slices++;
+    }
+
+    return n_slices;
+}
+
+void
+slice_hash_init(slice_hash_t *h, int n_slices)
+{
+    memset(h, 0, sizeof(*h));
+    EXPECT(n_slices > 0 && n_slices <= SLICE_MAX);
+    h->n_slices = n_slices;
+}
+
+static uint64_t
+slice_reduce(const slice_hash_t *h, uint64_t v)
+{
+    for (int b = 63; b >= 0; b--) {
+        if ((v >> b) & 1 && h->basis[b])
+            v ^= h->basis[b];
+    }
+    return v;
+}
+
+void
+slice_hash_same(slice_hash_t *h, uint64_t a, uint64_t b)
+{
+    const uint64_t v = slice_reduce(h, a ^ b);
+
+    EXPECT(!h->n_reps);
+    if (v)
+        h->basis[63 - __builtin_clzll(v)] = v;
+}
+
+int
+slice_hash_id(slice_hash_t *h, uint64_t addr)
+{
+    const uint64_t v = slice_reduce(h, addr);
+
+    for (int i = 0; i < h->n_reps; i++) {
+        if (h->rep[i] == v)
+            return i;
+    }
+    if (h->n_reps == h->n_slices)
+        return -1;
+    h->rep[h->n_reps] = v;
+    return h->n_reps++;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
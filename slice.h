@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * LLC slice calibration.
+ *
+ * The lines of one cache set index (within a slice) are split into
+ * slices with eviction tests: a set of lines evicts line x if it has
+ * at least ways lines in x's slice. slice_split() finds a minimal
+ * eviction set for a line, and then every line that can replace one
+ * of its members, which is the line's slice.
+ *
+ * Lines in the same slice give the slice hash differences of their
+ * physical addresses. With a linear (XOR) hash, those differences
+ * span the kernel of the hash, and every address reduces to one of
+ * n_slices representatives. The representatives label the slices
+ * relative to the set index; eviction tests can't tell which slice of
+ * one set is the same slice as one of another set.
+ */
+
+#ifndef SLICE_H
+#define SLICE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLICE_MAX 64
+
+/**
+ * Eviction test.
+ *
+ * @param x Line to test
+ * @param set Lines to access between two accesses to x
+ *
+ * @return Non-zero if the second access to x missed in the LLC
+ */
+typedef int (*slice_evict_fn)(void *arg, uint32_t x, const uint32_t *set,
+                              int n);
+
+typedef struct {
+    int n_slices;
+    /* Basis of the same-slice differences, basis[b] has its highest
+     * set bit at b, or is 0 */
+    uint64_t basis[64];
+    /* Reduced address of every slice found so far */
+    uint64_t rep[SLICE_MAX];
+    int n_reps;
+} slice_hash_t;
+
+/**
+ * Split the lines of one set index into slices.
+ *
+ * @param line Candidate lines, reordered by the split
+ * @param n Number of candidates
+ * @param ways Associativity of the LLC
+ * @param max_slices Stop after this many slices
+ * @param slice Set to the slice (0 to the return value - 1) of every
+ *              line in line[], -1 for lines that were left over
+ *
+ * @return Number of slices found.
+ */
+int slice_split(uint32_t *line, int n, int ways, int max_slices,
+                slice_evict_fn evicts, void *arg, int *slice);
+
+void slice_hash_init(slice_hash_t *h, int n_slices);
+
+/**
+ * Record that two addresses with the same set index are in the same
+ * slice. Must not be called after slice_hash_id().
+ */
+void slice_hash_same(slice_hash_t *h, uint64_t a, uint64_t b);
+
+/**
+ * Slice of an address, relative to its set index, which must be
+ * cleared in addr.
+ *
+ * @return Slice, 0 to n_slices - 1, or -1 if the address doesn't fit
+ *         any of the slices and there are already n_slices of them.
+ */
+int slice_hash_id(slice_hash_t *h, uint64_t addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
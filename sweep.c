@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "expect.h"
+#include "sweep.h"
+
+/* Two sided 95% quantile of the normal distribution */
+#define Z_95 1.96
+
+static double
+half_width(const sweep_point_t *p)
+{
+    if (p->n < 2)
+        return INFINITY;
+    return Z_95 * sqrt(p->m2 / (p->n - 1) / p->n);
+}
+
+/* Largest absolute mean, intervals are relative to the point's mean
+ * but never narrower than this times 1e-3 */
+static double
+mean_scale(const sweep_t *s)
+{
+    double scale = 0;
+
+    for (int i = 0; i < s->n_points; i++)
+        if (fabs(s->points[i].mean) > scale)
+            scale = fabs(s->points[i].mean);
+    return scale * 1e-3;
+}
+
+static double
+tolerance(const sweep_t *s, const sweep_point_t *p, double floor)
+{
+    return s->ci_width * fmax(fabs(p->mean), floor);
+}
+
+/* Second derivative of the curve at point i, 0 at the ends */
+static double
+curvature(const sweep_t *s, int i)
+{
+    const sweep_point_t *p = s->points;
+    double left, right;
+
+    if (i <= 0 || i >= s->n_points - 1)
+        return 0;
+
+    left = (p[i].mean - p[i - 1].mean) / (p[i].size - p[i - 1].size);
+    right = (p[i + 1].mean - p[i].mean) / (p[i + 1].size - p[i].size);
+    return (right - left) / ((p[i + 1].size - p[i - 1].size) / 2.0);
+}
+
+static void
+insert_point(sweep_t *s, int pos, uint32_t size)
+{
+    memmove(&s->points[pos + 1], &s->points[pos],
+            (s->n_points - pos) * sizeof(sweep_point_t));
+    memset(&s->points[pos], 0, sizeof(sweep_point_t));
+    s->points[pos].size = size;
+    s->n_points++;
+}
+
+/* Add a point in the middle of every interval that is too coarse for
+ * the curvature around it */
+static void
+refine(sweep_t *s)
+{
+    const double floor = mean_scale(s);
+    const int n = s->n_points;
+    double *c;
+    char *split;
+
+    EXPECT(c = malloc(n * sizeof(double)));
+    EXPECT(split = calloc(n, 1));
+
+    for (int i = 0; i < n; i++)
+        c[i] = curvature(s, i);
+
+    for (int i = 0; i < n - 1; i++) {
+        const double w = s->points[i + 1].size - s->points[i].size;
+        const double err = fmax(fabs(c[i]), fabs(c[i + 1])) * w * w / 8;
+        const double tol = fmin(tolerance(s, &s->points[i], floor),
+                                tolerance(s, &s->points[i + 1], floor));
+
+        split[i] = w >= 2 * s->min_step && err > tol;
+    }
+
+    /* Back to front, so that the indices stay valid */
+    for (int i = n - 2; i >= 0; i--) {
+        uint32_t mid;
+
+        if (!split[i] || s->n_points == s->max_points)
+            continue;
+        mid = (s->points[i].size + s->points[i + 1].size) / 2;
+        mid -= mid % s->min_step;
+        if (mid > s->points[i].size)
+            insert_point(s, i + 1, mid);
+    }
+
+    free(split);
+    free(c);
+}
+
+static void
+plan_round(sweep_t *s)
+{
+    double floor;
+    int warm = 1;
+
+    for (int i = 0; i < s->n_points; i++)
+        if (s->points[i].n < s->min_samples)
+            warm = 0;
+    if (warm)
+        refine(s);
+
+    floor = mean_scale(s);
+    s->round_len = 0;
+    s->round_pos = 0;
+    for (int i = 0; i < s->n_points; i++) {
+        const sweep_point_t *p = &s->points[i];
+
+        if (p->n < s->min_samples ||
+            half_width(p) > tolerance(s, p, floor))
+            s->round[s->round_len++] = i;
+    }
+}
+
+uint32_t
+sweep_init(sweep_t *s, uint32_t first, uint32_t step, uint32_t last,
+           uint32_t min_step, double ci_width, uint32_t min_samples)
+{
+    EXPECT(step > 0 && min_step > 0);
+
+    memset(s, 0, sizeof(*s));
+    s->min_step = min_step;
+    s->ci_width = ci_width;
+    s->min_samples = min_samples < 2 ? 2 : min_samples;
+    s->max_points = last / min_step + 1;
+
+    EXPECT(s->points = calloc(s->max_points, sizeof(sweep_point_t)));
+    EXPECT(s->round = malloc(s->max_points * sizeof(int)));
+
+    for (uint32_t size = first; size <= last; size += step)
+        s->points[s->n_points++].size = size;
+    EXPECT(s->n_points > 0 && s->n_points <= s->max_points);
+
+    plan_round(s);
+    return s->points[s->round[0]].size;
+}
+
+void
+sweep_free(sweep_t *s)
+{
+    free(s->points);
+    free(s->round);
+    s->points = NULL;
+    s->round = NULL;
+}
+
+void
+sweep_add(sweep_t *s, uint32_t size, double value)
+{
+    int lo = 0, hi = s->n_points - 1;
+
+    while (lo <= hi) {
+        const int mid = (lo + hi) / 2;
+        sweep_point_t *p = &s->points[mid];
+
+        if (p->size < size)
+            lo = mid + 1;
+        else if (p->size > size)
+            hi = mid - 1;
+        else {
+            const double delta = value - p->mean;
+
+            p->n++;
+            p->mean += delta / p->n;
+            p->m2 += delta * (value - p->mean);
+            return;
+        }
+    }
+}
+
+sweep_status_t
+sweep_next(sweep_t *s, uint32_t *size)
+{
+    if (++s->round_pos < s->round_len) {
+        *size = s->points[s->round[s->round_pos]].size;
+        return SWEEP_STEP;
+    }
+
+    plan_round(s);
+    if (!s->round_len)
+        return SWEEP_DONE;
+
+    *size = s->points[s->round[0]].size;
+    return SWEEP_NEW_CYCLE;
+}
+
+void
+sweep_print(FILE *out, const sweep_t *s)
+{
+    for (int i = 0; i < s->n_points; i++) {
+        const sweep_point_t *p = &s->points[i];
+
+        fprintf(out, "%10u: n=%-6" PRIu64 " mean=%g +/- %g\n",
+                p->size, p->n, p->mean, half_width(p));
+    }
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
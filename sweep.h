@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Adaptive sweep controller.
+ *
+ * The sweep starts with one point per way. Every point keeps a
+ * running mean and variance (Welford) of the metric measured at its
+ * size. The sweep runs in rounds, each an ascending walk over the
+ * points that still need samples: points with fewer than min_samples
+ * samples, or whose confidence interval is wider than ci_width times
+ * their mean. Between rounds, intervals where the curvature of the
+ * curve says that linear interpolation would be off by more than the
+ * target interval get a new point in the middle, down to min_step.
+ * The sweep is done when a round would be empty.
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default relative half width of the 95% confidence interval */
+#define SWEEP_DEFAULT_CI_WIDTH 0.02
+#define SWEEP_MIN_SAMPLES 4
+/* Smallest step is way_size / SWEEP_REFINE */
+#define SWEEP_REFINE 8
+
+typedef enum {
+    /* Next size in the same cycle */
+    SWEEP_STEP,
+    /* First size of a new cycle */
+    SWEEP_NEW_CYCLE,
+    /* All sizes have converged */
+    SWEEP_DONE,
+} sweep_status_t;
+
+typedef struct {
+    uint32_t size;
+    uint64_t n;
+    double mean;
+    /* Sum of squared differences from the mean */
+    double m2;
+} sweep_point_t;
+
+typedef struct {
+    uint32_t min_step;
+    double ci_width;
+    uint32_t min_samples;
+
+    /* Sorted by size */
+    sweep_point_t *points;
+    int n_points;
+    int max_points;
+
+    /* Indices of the points in the current round, ascending */
+    int *round;
+    int round_len;
+    int round_pos;
+} sweep_t;
+
+/**
+ * Set up a sweep over first, first + step, ... <= last.
+ *
+ * @param min_step Smallest distance between two sizes
+ * @param ci_width Target relative half width of the 95% confidence
+ *                 interval of every point
+ * @param min_samples Samples per point before its interval is trusted
+ * @return First size to sample
+ */
+uint32_t sweep_init(sweep_t *s, uint32_t first, uint32_t step, uint32_t last,
+                    uint32_t min_step, double ci_width, uint32_t min_samples);
+
+void sweep_free(sweep_t *s);
+
+/**
+ * Add a sample of the metric at a size.
+ */
+void sweep_add(sweep_t *s, uint32_t size, double value);
+
+/**
+ * Pick the next size to sample.
+ *
+ * @param size Next size, unchanged if the sweep is done
+ */
+sweep_status_t sweep_next(sweep_t *s, uint32_t *size);
+
+/**
+ * Print the mean and confidence interval of every point.
+ */
+void sweep_print(FILE *out, const sweep_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
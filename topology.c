@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "topology.h"
+
+#define CPU_DIR "/devices/system/cpu"
+
+static const char *sysfs_root = "/sys";
+
+void
+topo_set_root(const char *root)
+{
+    sysfs_root = root;
+}
+
+/* Read the first line of a file, without the newline */
+static int
+read_line(const char *path, char *buf, size_t len)
+{
+    FILE *fp;
+    char *nl;
+
+    if (!(fp = fopen(path, "r")))
+        return -1;
+    if (!fgets(buf, len, fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    if ((nl = strchr(buf, '\n')))
+        *nl = '\0';
+    return 0;
+}
+
+int
+topo_parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+
+    CPU_ZERO(set);
+    while (*p && *p != '\n') {
+        char *end;
+        long first, last;
+
+        first = last = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return -1;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+            p = end;
+        }
+        if (last >= CPU_SETSIZE)
+            return -1;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+
+        if (*p == ',')
+            p++;
+        else if (*p && *p != '\n')
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+topo_llc_path(int cpu, char *path, size_t len)
+{
+    int best_level = 0;
+
+    for (int index = 0; ; index++) {
+        char dir[256], file[300], buf[64];
+        int level;
+
+        snprintf(dir, sizeof(dir), "%s" CPU_DIR "/cpu%d/cache/index%d/",
+                 sysfs_root, cpu, index);
+        if (access(dir, F_OK) != 0)
+            break;
+
+        snprintf(file, sizeof(file), "%stype", dir);
+        if (read_line(file, buf, sizeof(buf)) == 0 &&
+            !strcmp(buf, "Instruction"))
+            continue;
+
+        snprintf(file, sizeof(file), "%slevel", dir);
+        if (read_line(file, buf, sizeof(buf)) != 0)
+            continue;
+        level = atoi(buf);
+
+        if (level > best_level) {
+            best_level = level;
+            snprintf(path, len, "%s", dir);
+        }
+    }
+
+    return best_level ? 0 : -1;
+}
+
+static int
+read_cpu_list(const char *path, cpu_set_t *set)
+{
+    char buf[4096];
+
+    if (read_line(path, buf, sizeof(buf)) != 0)
+        return -1;
+    return topo_parse_cpu_list(buf, set);
+}
+
+int
+topo_llc_cpus(int cpu, cpu_set_t *set)
+{
+    char dir[256], file[300];
+
+    if (topo_llc_path(cpu, dir, sizeof(dir)) != 0)
+        return -1;
+    snprintf(file, sizeof(file), "%sshared_cpu_list", dir);
+    return read_cpu_list(file, set);
+}
+
+int
+topo_siblings(int cpu, cpu_set_t *set)
+{
+    char file[300];
+
+    snprintf(file, sizeof(file),
+             "%s" CPU_DIR "/cpu%d/topology/thread_siblings_list",
+             sysfs_root, cpu);
+    if (read_cpu_list(file, set) == 0)
+        return 0;
+
+    /* Newer kernels call it core_cpus_list */
+    snprintf(file, sizeof(file),
+             "%s" CPU_DIR "/cpu%d/topology/core_cpus_list",
+             sysfs_root, cpu);
+    return read_cpu_list(file, set);
+}
+
+int
+topo_check_pirate(int target_cpu, int pirate_cpu)
+{
+    cpu_set_t llc, siblings;
+
+    if (topo_llc_cpus(target_cpu, &llc) != 0)
+        return -1;
+    if (!CPU_ISSET(pirate_cpu, &llc))
+        return TOPO_PIRATE_OTHER_LLC;
+    if (topo_siblings(target_cpu, &siblings) == 0 &&
+        CPU_ISSET(pirate_cpu, &siblings))
+        return TOPO_PIRATE_SIBLING;
+
+    return TOPO_PIRATE_OK;
+}
+
+int
+topo_pick_pirates(int target_cpu, const cpu_set_t *allowed,
+                  int *cpus, int max)
+{
+    cpu_set_t llc, taken;
+    int n = 0;
+
+    if (topo_llc_cpus(target_cpu, &llc) != 0 ||
+        topo_siblings(target_cpu, &taken) != 0)
+        return -1;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        cpu_set_t siblings;
+
+        if (!CPU_ISSET(cpu, &llc) || CPU_ISSET(cpu, &taken) ||
+            !CPU_ISSET(cpu, allowed))
+            continue;
+        if (topo_siblings(cpu, &siblings) != 0)
+            return -1;
+
+        /* One thread per core */
+        CPU_OR(&taken, &taken, &siblings);
+        cpus[n++] = cpu;
+    }
+
+    return n;
+}
+
+int
+topo_llc_domains(const cpu_set_t *allowed, cpu_set_t *domains, int max)
+{
+    cpu_set_t seen;
+    int n = 0;
+
+    CPU_ZERO(&seen);
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        cpu_set_t llc;
+
+        if (!CPU_ISSET(cpu, allowed) || CPU_ISSET(cpu, &seen))
+            continue;
+        if (topo_llc_cpus(cpu, &llc) != 0)
+            return -1;
+
+        CPU_OR(&seen, &seen, &llc);
+        CPU_AND(&domains[n], &llc, allowed);
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * CPU and cache topology from sysfs.
+ *
+ * Everything is read from <root>/devices/system/cpu, where root is
+ * /sys unless topo_set_root() has been called, so that the placement
+ * logic can be run against a canned copy of another machine's tree.
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+/* cpu_set_t needs _GNU_SOURCE before the first include of sched.h */
+#include <sched.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Use root instead of /sys for all lookups.
+ */
+void topo_set_root(const char *root);
+
+/**
+ * Parse a CPU list such as "0-3,8,10-11" into set.
+ *
+ * @return 0 on success, -1 on a malformed list.
+ */
+int topo_parse_cpu_list(const char *list, cpu_set_t *set);
+
+/**
+ * Find the sysfs directory of the last level data or unified cache
+ * of a CPU. The path ends with a '/'.
+ *
+ * @return 0 on success, -1 if the CPU has no cache information.
+ */
+int topo_llc_path(int cpu, char *path, size_t len);
+
+/**
+ * CPUs that share the last level cache with cpu, including cpu.
+ *
+ * @return 0 on success, -1 if the information isn't available.
+ */
+int topo_llc_cpus(int cpu, cpu_set_t *set);
+
+/**
+ * Hardware threads in the same core as cpu, including cpu.
+ *
+ * @return 0 on success, -1 if the information isn't available.
+ */
+int topo_siblings(int cpu, cpu_set_t *set);
+
+/* Results of topo_check_pirate() */
+enum {
+    TOPO_PIRATE_OK = 0,
+    /* The pirate doesn't share the target's last level cache */
+    TOPO_PIRATE_OTHER_LLC,
+    /* The pirate is a hardware thread in the target's core */
+    TOPO_PIRATE_SIBLING,
+};
+
+/**
+ * Check that a pirate on pirate_cpu shares the last level cache with
+ * a target on target_cpu, but not its core. The core isn't checked if
+ * there is no sibling information.
+ *
+ * @return One of TOPO_PIRATE_*, -1 if the cache information isn't
+ * available.
+ */
+int topo_check_pirate(int target_cpu, int pirate_cpu);
+
+/**
+ * Pick pirate CPUs for a target on target_cpu: one hardware thread in
+ * every core that shares the target's last level cache, except the
+ * target's own core. Only CPUs in allowed are used.
+ *
+ * @param cpus Picked CPUs, at most max of them
+ * @return Number of CPUs picked, -1 if the topology isn't available.
+ */
+int topo_pick_pirates(int target_cpu, const cpu_set_t *allowed,
+                      int *cpus, int max);
+
+/**
+ * Split the CPUs in allowed into last level cache domains.
+ *
+ * @param domains CPUs of each domain, at most max of them
+ * @return Number of domains, -1 if the topology isn't available.
+ */
+int topo_llc_domains(const cpu_set_t *allowed, cpu_set_t *domains, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */
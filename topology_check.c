@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2013, Ragnar Hagg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks the placement logic in topology.c against the canned sysfs
+ * tree in tests/topology: two sockets of six cores with two hardware
+ * threads each, and two last level caches of three cores per socket.
+ * CPU n and n + 12 are the threads of core n, cores 0-2, 3-5, 6-8 and
+ * 9-11 share a last level cache.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "topology.h"
+
+#define CHECK_ROOT "tests/topology"
+
+static int failed = 0;
+
+#define CHECK(expr)                                                     \
+    do {                                                                \
+        if (!(expr)) {                                                  \
+            fprintf(stderr, "%s:%i: Check failed: %s\n",                \
+                    __FILE__, __LINE__, # expr);                        \
+            failed++;                                                   \
+        }                                                               \
+    } while (0)
+
+/* Pick pirates for target_cpu among the CPUs in allowed_list and
+ * compare them with the expected list */
+static int
+picks(int target_cpu, const char *allowed_list, const char *expected)
+{
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE], n;
+    char got[256] = "";
+
+    if (topo_parse_cpu_list(allowed_list, &allowed) != 0)
+        return 0;
+    n = topo_pick_pirates(target_cpu, &allowed, cpus, CPU_SETSIZE);
+    for (int i = 0; i < n; i++)
+        snprintf(got + strlen(got), sizeof(got) - strlen(got), "%s%d",
+                 i ? "," : "", cpus[i]);
+
+    if (strcmp(got, expected)) {
+        fprintf(stderr, "Target CPU %d, allowed %s: picked %s, "
+                "expected %s\n", target_cpu, allowed_list, got, expected);
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    cpu_set_t set, all, domains[8];
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [SYSFS_ROOT]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    topo_set_root(argc > 1 ? argv[1] : CHECK_ROOT);
+
+    /* The LLC is index3, not the instruction cache or L2 */
+    CHECK(topo_llc_cpus(0, &set) == 0);
+    CHECK(CPU_COUNT(&set) == 6 && CPU_ISSET(14, &set) &&
+          !CPU_ISSET(3, &set));
+    CHECK(topo_siblings(13, &set) == 0);
+    CHECK(CPU_COUNT(&set) == 2 && CPU_ISSET(1, &set));
+    CHECK(topo_llc_cpus(24, &set) == -1);
+
+    /* -C validation */
+    CHECK(topo_check_pirate(0, 1) == TOPO_PIRATE_OK);
+    CHECK(topo_check_pirate(0, 14) == TOPO_PIRATE_OK);
+    CHECK(topo_check_pirate(0, 0) == TOPO_PIRATE_SIBLING);
+    CHECK(topo_check_pirate(0, 12) == TOPO_PIRATE_SIBLING);
+    CHECK(topo_check_pirate(13, 1) == TOPO_PIRATE_SIBLING);
+    /* The other LLC of the same socket, and the other socket */
+    CHECK(topo_check_pirate(0, 3) == TOPO_PIRATE_OTHER_LLC);
+    CHECK(topo_check_pirate(0, 15) == TOPO_PIRATE_OTHER_LLC);
+    CHECK(topo_check_pirate(0, 6) == TOPO_PIRATE_OTHER_LLC);
+    CHECK(topo_check_pirate(24, 1) == -1);
+
+    /* Default placement, one thread in every other core of the LLC */
+    CHECK(picks(0, "0-23", "1,2"));
+    CHECK(picks(13, "0-23", "0,2"));
+    CHECK(picks(10, "0-23", "9,11"));
+    CHECK(picks(0, "0,2-23", "2,13"));
+    CHECK(picks(0, "0-2", "1,2"));
+    CHECK(picks(0, "0,12", ""));
+
+    /* --domains */
+    CHECK(topo_parse_cpu_list("0-23", &all) == 0);
+    CHECK(topo_llc_domains(&all, domains, 8) == 4);
+    CHECK(CPU_COUNT(&domains[1]) == 6 && CPU_ISSET(3, &domains[1]) &&
+          CPU_ISSET(17, &domains[1]));
+    CHECK(topo_parse_cpu_list("1,7-8", &all) == 0);
+    CHECK(topo_llc_domains(&all, domains, 8) == 2);
+    CHECK(CPU_COUNT(&domains[1]) == 2);
+
+    if (failed) {
+        fprintf(stderr, "%d topology checks failed\n", failed);
+        return EXIT_FAILURE;
+    }
+    printf("Topology checks passed\n");
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "k&r"
+ * End:
+ */